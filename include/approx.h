@@ -0,0 +1,55 @@
+/* include/approx.h
+ *
+ * approximate sequence search, within a number of edits
+ */
+
+#ifndef APPROX_H
+#define APPROX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <genetree.h>
+#include <search.h>
+
+/* longest pattern accepted, so per-sequence state fits on the stack */
+#define APPROX_MAX_LEN 4096
+
+/*
+ * struct approx_search : state of one search-seq-approx
+ *
+ * Matching uses Myers' bit-vector algorithm (in Hyyro's formulation, one
+ * 64-bit word per 64 pattern bytes), which tracks a whole column of the
+ * edit distance table in a few word operations per sequence byte.
+ * PEQ[c * NWORDS + w] has bit i set where pattern byte 64w + i is c.
+ */
+
+struct approx_search {
+	struct search_result result;
+
+	const char *pattern;
+	size_t pattern_len;
+	size_t max_edits;
+
+	size_t nwords;
+	uint64_t *peq;
+};
+
+/* Prepare SEARCH for PATTERN with up to MAX_EDITS substitutions, insertions
+   and deletions. Return 0 on success, -1 on failure. */
+int approx_init (struct approx_search *search, const char *pattern, size_t len,
+		 size_t max_edits, struct search_out *out);
+
+void approx_free (struct approx_search *search);
+
+/*
+ * search_tree() callback: ARG is a struct approx_search.
+ *
+ * Every stretch of consecutive end positions within MAX_EDITS is reported
+ * once, at its best (lowest distance) end, starting from the nearest
+ * start that achieves that distance. Return number of matches in NODE, or
+ * -1 if its sequence can't be read.
+ */
+int search_approx (const struct gene_node *node, void *arg);
+
+#endif /* APPROX_H */
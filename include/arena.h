@@ -0,0 +1,42 @@
+/* include/arena.h
+ *
+ * bump allocator owning the nodes (and any copied strings) of a gene_tree
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * struct arena : list of large blocks, carved up front to back
+ *
+ * There is no way to free a single allocation: everything allocated from
+ * an arena is released together by arena_free(), at a cost proportional
+ * to the number of blocks rather than the number of allocations.
+ */
+
+struct arena_block;
+
+struct arena {
+	struct arena_block *head; /* block currently being carved */
+
+	size_t next_size; /* size of the next block to be allocated */
+	size_t total; /* bytes held in all blocks */
+};
+
+void arena_init (struct arena *arena);
+
+/* Return SIZE bytes aligned for any type, or NULL on failure. */
+void *arena_alloc (struct arena *arena, size_t size);
+
+/* Return a copy of the LEN bytes at SRC, or NULL on failure. */
+void *arena_memdup (struct arena *arena, const void *src, size_t len);
+
+/* Release every block held by ARENA and reinitialise it. */
+void arena_free (struct arena *arena);
+
+/* Move every block held by SRC into DEST, leaving SRC empty. */
+void arena_adopt (struct arena *dest, struct arena *src);
+
+#endif /* ARENA_H */
@@ -0,0 +1,49 @@
+/* include/bgzf.h
+ *
+ * gzip and BGZF (blocked gzip, as written by bgzip) decompression and
+ * BGZF compression, spread over threads
+ */
+
+#ifndef BGZF_H
+#define BGZF_H
+
+#include <stddef.h>
+
+/* largest BGZF block, compressed or not */
+#define BGZF_BLOCK_MAX 65536
+
+/* uncompressed bytes per block written, as bgzip does, so that even
+   incompressible data fits a block */
+#define BGZF_BLOCK_DATA 65280
+
+/* the empty block bgzip ends its files with */
+#define BGZF_EOF_LEN 28
+extern const unsigned char bgzf_eof[BGZF_EOF_LEN];
+
+/* Return 1 if the LEN bytes at DATA start with a gzip header, else 0. */
+int bgzf_is_gzip (const char *data, size_t len);
+
+/*
+ * bgzf_decompress() : inflate the gzip data [IN, IN + LEN)
+ *
+ * BGZF files record the size of each block and of its contents, so the
+ * output is allocated once and the blocks inflated straight into place,
+ * on up to NTHREADS threads. Any other gzip file, including one of
+ * several concatenated members, is inflated as a stream on one thread.
+ *
+ * On success, set *OUT to the malloc()ed result and *OUT_LEN to its
+ * length, and return 0. Return -1 if the data is corrupt or memory runs
+ * out.
+ */
+int bgzf_decompress (const char *in, size_t len, size_t nthreads, char **out, size_t *out_len);
+
+/* Room needed by bgzf_compress() for LEN bytes. */
+size_t bgzf_bound (size_t len);
+
+/* Compress the LEN bytes at IN into BGZF blocks at OUT, which has room for
+   bgzf_bound(LEN) bytes, on up to NTHREADS threads. The end-of-file block
+   is not included. Return the number of bytes written to OUT, or 0 on
+   failure. */
+size_t bgzf_compress (const char *in, size_t len, char *out, size_t nthreads);
+
+#endif /* BGZF_H */
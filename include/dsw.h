@@ -3,8 +3,6 @@
 
 void tree_to_vine (struct gene_tree *gene_tree);
 
-void vine_to_tree (struct gene_tree *gene_tree);
-
-void balance_tree (struct gene_tree *gene_tree);
+struct gene_node *build_balanced_tree (struct gene_node **nodes, size_t n);
 
 #endif /* DSW_H */
@@ -0,0 +1,77 @@
+/* include/faidx.h
+ *
+ * on-disk record index of a FASTA file, in the manner of samtools faidx
+ */
+
+#ifndef FAIDX_H
+#define FAIDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arena.h>
+#include <mapfile.h>
+#include <parse.h>
+
+/* the index of FILE is kept in FILE.fpi */
+#define FAIDX_SUFFIX ".fpi"
+
+/*
+ * struct faidx_entry : where one record lies in its FASTA file
+ *
+ * Every line of a sequence but the last holds LINE_BASES bases and takes
+ * LINE_WIDTH bytes, newline included, so base I of the sequence is at byte
+ * OFFSET + I / LINE_BASES * LINE_WIDTH + I % LINE_BASES.
+ */
+
+struct faidx_entry {
+	const char *defline;
+	size_t defline_len;
+
+	uint64_t length; /* in bases */
+	uint64_t offset; /* of the first base */
+	uint32_t line_bases;
+	uint32_t line_width;
+};
+
+/*
+ * struct faidx : the index of one FASTA file
+ *
+ * The index file is a header line, "#fproc-index SIZE MTIME", recording
+ * the FASTA file it was built from, then one line per record:
+ * DEFLINE<tab>LENGTH<tab>OFFSET<tab>LINE_BASES<tab>LINE_WIDTH. Records
+ * are in file order. Deflines point into MAP, the index file mapped.
+ */
+
+struct faidx {
+	struct faidx_entry *entries;
+	size_t size;
+
+	struct gene_map *map;
+};
+
+/* Index FILENAME and write the index to FILENAME.fpi.
+   Return the number of records indexed, or -1 on failure. */
+long faidx_build (const char *filename);
+
+/* Load the index of FILENAME. Return NULL if there is none, or it no longer
+   matches FILENAME, or on failure. */
+struct faidx *faidx_load (const char *filename);
+
+/* Fill LIST with INDEX's records, whose sequences are in the TEXT_LEN bytes
+   of the file at TEXT. Wrapped lines are joined in place, on up to
+   NTHREADS threads. Return 0 on success, -1 on failure. */
+int faidx_records (const struct faidx *index, char *text, size_t text_len, size_t nthreads,
+		   struct record_list *list);
+
+/* Fill LIST with INDEX's records, with sequences left in the file open as
+   FD, to be read when needed. Their locations are allocated in ARENA.
+   Return 0 on success, -1 on failure. */
+int faidx_lazy_records (const struct faidx *index, int fd, struct arena *arena,
+			struct record_list *list);
+
+/* Free INDEX and unmap its file, which the deflines of records filled from
+   it point into. */
+void faidx_free (struct faidx *index);
+
+#endif /* FAIDX_H */
@@ -0,0 +1,68 @@
+/* include/fmindex.h
+ *
+ * FM-index over the concatenated sequences of a gene_tree
+ */
+
+#ifndef FM_INDEX_H
+#define FM_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <genetree.h>
+
+/*
+ * struct fm_index : Burrows-Wheeler transform with rank and locate support
+ *
+ * The indexed text is every sequence in defline order, each followed by a
+ * separator, with the bytes that occur renumbered into a dense alphabet.
+ * Counting a pattern is a backward search costing two rank queries per
+ * pattern byte; a rank query is a checkpoint lookup plus a 64-byte
+ * compare-and-popcount. Suffix array entries are kept only for text
+ * positions that are multiples of FM_SAMPLE, so locating a match walks
+ * backwards along the text until it reaches one.
+ */
+
+#define FM_SAMPLE 32
+
+struct fm_index {
+	size_t len; /* text length, separators and terminator included */
+
+	uint8_t symbols[256]; /* byte -> symbol, 0 if absent from the text */
+	size_t nsymbols;
+
+	uint8_t *bwt; /* LEN symbols, padded to a multiple of 64 */
+	uint32_t *occ; /* per 64 rows, count of each symbol in earlier rows */
+	uint64_t *less; /* less[c] : number of text symbols below c */
+
+	uint64_t *sampled; /* bit per row: is its suffix array entry kept */
+	uint32_t *sampled_rank; /* per 64 rows, number of sampled rows before */
+	uint32_t *samples; /* kept suffix array entries, in row order */
+
+	/* records by rank, and where each starts in the text */
+	size_t nrecords;
+	struct gene_node **records;
+	uint64_t *starts;
+};
+
+/* half-open range of BWT rows whose suffixes begin with a pattern */
+struct fm_range {
+	size_t begin;
+	size_t end;
+};
+
+/* Build an FM-index over the sequences of TREE. Return NULL on failure. */
+struct fm_index *fm_index_build (const struct gene_tree *tree);
+
+/* Set RANGE to the rows prefixed by the LEN bytes at PATTERN, and return
+   the number of occurrences. */
+size_t fm_index_count (const struct fm_index *index, const char *pattern, size_t len,
+		       struct fm_range *range);
+
+/* Return the rank of the record holding the occurrence at ROW, and set
+   *OFFSET to its position in that record's sequence. */
+size_t fm_index_locate (const struct fm_index *index, size_t row, size_t *offset);
+
+void fm_index_free (struct fm_index *index);
+
+#endif /* FM_INDEX_H */
@@ -3,35 +3,105 @@
 #define FPROC_H
 
 #include <genetree.h>
+#include <hashindex.h>
 
-/* initialise file buffer and store contents of INFILE */
-int fproc_read(const char *infile);
+/* initialise file buffer and store contents of INFILE, parsed by NTHREADS threads,
+   or only its deflines, reading sequences when needed, if LAZY or INFILE
+   won't fit in the memory budget */
+int fproc_read(const char *infile, const size_t nthreads, int lazy);
 
-/* initialise file buffer N if not empty and store contents of INFILE.
-   does nothing if N is already allocated */
-int fproc_read_n(const char *infile, const size_t destN);
+/* initialise file buffer N if not empty and store contents of INFILE,
+   parsed by NTHREADS threads (lazily if LAZY). does nothing if N is already allocated */
+int fproc_read_n(const char *infile, const size_t destN, const size_t nthreads, int lazy);
+
+/* index INFILE, so that reading it needs no parsing and can be lazy */
+int fproc_index(const char *infile);
+
+/* load snapshot INFILE, saved by fproc_save(), into the first free buffer */
+int fproc_load(const char *infile);
+
+/* save gene_tree in buffer SRCN as a snapshot in OUTFILE, to be reloaded
+   without parsing */
+int fproc_save(const size_t srcN, const char *outfile);
 
 /* print deflines gene_tree corresponding to SRC_FILE to stdout */
 void fproc_print(const size_t srcN);
 
-/* print deflines and sequences corresponding to SRC_FILE to stdout */
-void fproc_print_all(const size_t srcN);
+/* print deflines and sequences corresponding to SRC_FILE to stdout,
+   sequences wrapped at WRAP bases per line unless WRAP is 0 */
+void fproc_print_all(const size_t srcN, const size_t wrap);
 
 /* print contents of file_array */
 void fproc_list(void);
 
-/* write gene_tree corresponding to SRC_FILE to OUTFILE */
-int fproc_write(const size_t srcN, const char *outfile);
+/* write gene_tree corresponding to SRC_FILE to OUTFILE, sequences wrapped at
+   WRAP bases per line unless WRAP is 0, bypassing the page cache if DIRECT,
+   or compressed as BGZF on BGZF_THREADS threads unless that is 0 */
+int fproc_write(const size_t srcN, const char *outfile, const size_t wrap, const int direct,
+		const size_t bgzf_threads);
 
 /* add gene_tree corresponding to SRC_TREE to gene tree corresponding to DEST_TREE and rebalance */
 int fproc_merge(const size_t srcN, const size_t destN);
 
+/* merge buffers SRCN[1..N-1] into buffer SRCN[0] (all buffers into the
+   first if N is 0) in one pass, using NTHREADS threads */
+int fproc_merge_all(const size_t *srcN, const size_t n, const size_t nthreads);
+
+/* store sequences of GENE_TREE at 2 bits per base where possible */
+int fproc_pack(const size_t srcN);
+
+/* index GENE_TREE by accession or full defline for `get' */
+int fproc_index_label(const size_t srcN, const enum index_key key);
+
+/* index GENE_TREE by K-mer for search-seq, loading from or saving to INDEXFILE
+   if it is not NULL */
+int fproc_index_kmer(const size_t srcN, const unsigned k, const char *indexfile);
+
+/* print records of GENE_TREE whose accession (or defline, if so indexed)
+   is one of the N strings in IDS */
+int fproc_get(const size_t srcN, char *const *ids, const size_t n);
+
+/* print the N regions (ID, ID:START or ID:START-END) in REGIONS of records
+   of GENE_TREE, found as `get' finds them, reverse complemented if REVCOMP */
+int fproc_extract(const size_t srcN, char *const *regions, const size_t n, const int revcomp);
+
+/* as fproc_extract(), for every region listed in BED-format BEDFILE */
+int fproc_extract_bed(const size_t srcN, const char *bedfile, const int revcomp);
+
+/* print records of GENE_TREE whose deflines start with PREFIX, in order */
+int fproc_prefix(const size_t srcN, const char *prefix);
+
+/* print records of GENE_TREE with FROM <= defline < TO, in order */
+int fproc_range(const size_t srcN, const char *from, const char *to);
+
 /* search GENE_TREE for a defline containing STRING */
 int fproc_search_defline(const size_t srcN, const char *string);
 
 /* search GENE_TREE for a sequence containing STRING */
 int fproc_search_sequence(const size_t srcN, const char *string);
 
+/* search GENE_TREE's sequences for IUPAC pattern STRING, on both strands
+   if BOTH_STRANDS */
+int fproc_search_strands(const size_t srcN, const char *string, const int both_strands);
+
+/* count STRING in GENE_TREE's sequences by FM-index, listing matches if LOCATE */
+int fproc_search_fm(const size_t srcN, const char *string, const int locate);
+
+/* search GENE_TREE's sequences for STRING allowing up to MAX_EDITS edits */
+int fproc_search_approx(const size_t srcN, const char *string, const size_t max_edits);
+
+/* search GENE_TREE's sequences for all patterns in PATTERNFILE in one pass */
+int fproc_search_multi(const size_t srcN, const char *patternfile);
+
+/* limit the memory buffers may use to BUDGET bytes (0 for no limit): files
+   read beyond it are read lazily, buffers held beyond it have their
+   sequences dropped to be read lazily too, and sequences read lazily are
+   cached within what is left */
+int fproc_budget(const size_t budget);
+
+/* print the memory budget and sequence cache counters */
+void fproc_memory(void);
+
 /* delete GENE_TREE */
 int fproc_delete(const size_t srcN);
 
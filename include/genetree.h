@@ -1,20 +1,96 @@
 #ifndef GENE_TREE_H
 #define GENE_TREE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arena.h>
+#include <mapfile.h>
+#include <packseq.h>
+
 /* 
  * struct gene_node : leaf of binary tree
+ *
+ * DEFLINE and SEQUENCE are NOT null-terminated: always use the stored
+ * lengths. The defline excludes the leading '>' and both exclude the
+ * trailing newline.
+ *
+ * Deflines are copied into the tree's arena when it is built, packed
+ * together in order right after the nodes, while sequences stay in the
+ * file the node was read from or go in the tree's sequence arena. So
+ * anything that only needs deflines - ordering, lookups, print and
+ * search-label - never touches a page holding sequence. KEY holds the
+ * first bytes of the defline, so most comparisons are settled by it
+ * without reading the defline at all; the fields needed to descend the
+ * tree come first, to share a cache line.
+ *
+ * Once packed, SEQUENCE is NULL and the bases are held in PACKED. Read
+ * lazily, SEQUENCE is NULL and LAZY says where in its file the sequence
+ * is, to be read when it is needed, or kept for a while under a memory
+ * budget. Either way, use gene_node_sequence() rather than reading
+ * SEQUENCE directly.
  */
 
+struct seq_cache_entry;
+
+/* where a sequence not held in memory lies: see struct faidx_entry */
+struct lazy_seq {
+	int fd;
+	uint32_t line_bases;
+	uint32_t line_width;
+	uint64_t offset;
+
+	struct seq_cache_entry *cached; /* NULL if not cached: see seqcache.h */
+};
+
+/* bytes of file holding the COUNT bases from FROM of the sequence at LAZY,
+   line ends included */
+size_t lazy_seq_span (const struct lazy_seq *lazy, size_t from, size_t count);
+
+/* Read the COUNT bases from FROM of the sequence at LAZY into BUF, which
+   must have room for lazy_seq_span() bytes. Return 0 on success, -1 on
+   failure. */
+int lazy_seq_read (const struct lazy_seq *lazy, size_t from, size_t count, char *buf);
+
 struct gene_node {
-	char *defline;
-	char *sequence;
+	uint64_t key; /* see gene_key_prefix() */
+	const char *defline;
+	size_t defline_len;
 
 	struct gene_node *right;
 	struct gene_node *left;
+
+	const char *sequence;
+	size_t sequence_len; /* in bases, packed or not */
+
+	struct packed_seq *packed;
+	struct lazy_seq *lazy;
 };
 
+/* bytes of a defline held in a node's KEY */
+#define GENE_KEY_LEN 8
+
 int genecmp (const struct gene_node *g1, const struct gene_node *g2);
 
+int genecmp_key (const struct gene_node *node, const char *key, size_t len);
+
+/* The first GENE_KEY_LEN bytes of the LEN bytes at KEY, zero-padded, as
+   a big-endian number: prefixes compare as numbers as the deflines they
+   start would compare, or are equal. */
+uint64_t gene_key_prefix (const char *key, size_t len);
+
+struct gene_index;
+struct kmer_index;
+struct fm_index;
+
+/* Return the sequence of NODE as text, or NULL on failure. Packed and lazy
+   sequences are unpacked or read into a per-thread buffer, which is
+   overwritten by the next call on that thread. */
+const char *gene_node_sequence (const struct gene_node *node);
+
+/* As gene_node_sequence(), but only the COUNT bases starting at FROM. */
+const char *gene_node_window (const struct gene_node *node, size_t from, size_t count);
+
 /*
  * struct gene_tree : 
  *
@@ -31,6 +107,15 @@ struct gene_tree {
 
 	size_t size; 
 	struct gene_node *root;
+
+	struct gene_map *maps; /* backing storage for sequences */
+	struct arena arena; /* nodes and deflines */
+	struct arena seq_arena; /* sequences copied out of maps, and where lazy ones lie */
+
+	struct gene_index *index; /* exact lookup by defline, or NULL if not built */
+	/* sequence search indexes, or NULL; dropped on any change */
+	struct kmer_index *kmers;
+	struct fm_index *fm;
 };
 
 struct gene_tree *init_gene_tree (const char *filename, size_t file_len);
@@ -40,4 +125,10 @@ void free_gene_tree (struct gene_tree *gene_tree);
 int gene_tree_insert (struct gene_tree *gene_tree,
 		      const char *defline, size_t defline_len, const char *sequence, size_t sequence_len);
 
+void gene_tree_adopt (struct gene_tree *dest_tree, struct gene_tree *src_tree);
+
+struct gene_record;
+
+int gene_tree_build (struct gene_tree *gene_tree, struct gene_record *const *recs, size_t n);
+
 #endif /* GENE_TREE_H */
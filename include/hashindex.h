@@ -0,0 +1,48 @@
+/* include/hashindex.h
+ *
+ * hash index for exact lookup of gene_nodes by defline or accession
+ */
+
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <stddef.h>
+
+#include <genetree.h>
+
+/* what a node is indexed under */
+enum index_key {
+	INDEX_ACCESSION, /* first whitespace-delimited token of the defline */
+	INDEX_DEFLINE    /* the whole defline */
+};
+
+/*
+ * struct gene_index : open-addressed hash table of node pointers
+ *
+ * Several nodes may share an accession, so lookups can return more than
+ * one node: see index_find(). Nodes are never moved by rebalancing, so
+ * the table stays valid as long as its nodes are alive.
+ */
+
+struct gene_index {
+	enum index_key key;
+
+	size_t size;
+	size_t capacity; /* always a power of two */
+	struct gene_node **slots;
+};
+
+/* Index every node in TREE under KEY. Return NULL on failure. */
+struct gene_index *index_build (const struct gene_tree *tree, enum index_key key);
+
+/* Add NODE to INDEX. Return 0 on success, -1 on failure. */
+int index_insert (struct gene_index *index, struct gene_node *node);
+
+/* Return the next node indexed under the LEN bytes at KEY, or NULL when
+   there are no more. *CURSOR must be 0 on the first call for a key. */
+struct gene_node *index_find (const struct gene_index *index, const char *key, size_t len,
+			      size_t *cursor);
+
+void index_free (struct gene_index *index);
+
+#endif /* HASH_INDEX_H */
@@ -0,0 +1,76 @@
+/* include/kmerindex.h
+ *
+ * k-mer posting index, so sequence searches need not scan every base
+ */
+
+#ifndef KMER_INDEX_H
+#define KMER_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <genetree.h>
+#include <mapfile.h>
+#include <search.h>
+
+#define KMER_MIN 4
+#define KMER_MAX 32
+
+/* position of one k-mer: record rank (in defline order) and base offset */
+struct kmer_hit {
+	uint32_t record;
+	uint32_t offset;
+};
+
+/*
+ * struct kmer_index : every k-mer of every sequence, bucketed by value
+ *
+ * K-mers are read case-insensitively as 2-bit ACGT codes; any window
+ * containing another character is not indexed. When 4^K buckets would be
+ * too many, codes are hashed into fewer, so a bucket is a superset of the
+ * positions of any one k-mer and candidates are always verified against
+ * the sequence. Within a bucket, hits are sorted by (record, offset).
+ *
+ * STARTS and HITS either point into MAP, when the index was loaded from
+ * a file, or were malloc()ed when it was built in memory.
+ */
+
+struct kmer_index {
+	unsigned k;
+	unsigned bits; /* log2 of the number of buckets */
+
+	const uint64_t *starts; /* bucket b is hits[starts[b], starts[b + 1]) */
+	const struct kmer_hit *hits;
+	size_t nhits;
+
+	/* the tree indexed, for checking a saved index still applies */
+	size_t nrecords;
+	uint64_t checksum;
+	struct gene_node **records; /* nodes by rank */
+
+	struct gene_map *map; /* NULL if built in memory */
+};
+
+/* Index every K-mer in TREE. Return NULL on failure. */
+struct kmer_index *kmer_index_build (const struct gene_tree *tree, unsigned k);
+
+/* Write INDEX to FILENAME. Return 0 on success, -1 on failure. */
+int kmer_index_save (const struct kmer_index *index, const char *filename);
+
+/* Map an index saved by kmer_index_save() for TREE. Return NULL on failure,
+   or if the file was saved for different contents. */
+struct kmer_index *kmer_index_load (const struct gene_tree *tree, const char *filename);
+
+/* Can INDEX find the LEN-byte PATTERN, or is it too short or ambiguous
+   to have a k-mer to look up? */
+int kmer_index_usable (const struct kmer_index *index, const char *pattern, size_t len);
+
+/* Find every occurrence of SEARCH's pattern using INDEX, writing matches
+   as search_sequence() does. Return the number of records matched, or -1
+   if the pattern is not kmer_index_usable(), or (having said why) on
+   failure, when matches may already have been written. */
+long kmer_index_search (const struct kmer_index *index, struct substring_search *search);
+
+void kmer_index_free (struct kmer_index *index);
+
+#endif /* KMER_INDEX_H */
@@ -0,0 +1,46 @@
+/* include/mapfile.h
+ *
+ * private file mappings backing the strings stored in a gene_tree
+ */
+
+#ifndef MAP_FILE_H
+#define MAP_FILE_H
+
+#include <stddef.h>
+
+/*
+ * struct gene_map : contents of one input file
+ *
+ * Regular files are mmap()ed copy-on-write; anything that cannot be mapped (pipes,
+ * empty files) is read into a heap buffer instead. Nodes point directly
+ * into ADDR, so a map must outlive every node referencing it.
+ *
+ * A file read lazily is not mapped at all: FD stays open instead, for
+ * nodes to read their sequences from.
+ */
+
+struct gene_map {
+	char *addr;
+	size_t len;
+	int mapped; /* 1 if ADDR came from mmap(), 0 if from malloc() */
+	int fd; /* -1 unless the file is held open */
+
+	struct gene_map *next;
+};
+
+struct gene_map *map_file (const char *filename);
+
+/* Open FILENAME to be read from as needed, mapping nothing.
+   Return NULL on failure. */
+struct gene_map *open_file (const char *filename);
+
+/* As map_file(), but if FILENAME is gzip or BGZF compressed, hold its
+   decompressed contents instead, inflated on up to NTHREADS threads. */
+struct gene_map *map_input (const char *filename, size_t nthreads);
+
+void unmap_file (struct gene_map *map);
+
+/* unmap every map in the list starting at MAP */
+void unmap_file_list (struct gene_map *map);
+
+#endif /* MAP_FILE_H */
@@ -0,0 +1,19 @@
+/* include/merge.h
+ *
+ * merging any number of gene_trees at once
+ */
+
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stddef.h>
+
+#include <genetree.h>
+
+/* Merge TREES[1..NTREES-1] into TREES[0] using up to NTHREADS threads, and
+   free them. Where several trees hold the same defline, the node from the
+   tree earliest in TREES is kept, as if merged one at a time into TREES[0].
+   Return 0 on success, -1 on failure (all trees are left intact). */
+int merge_trees (struct gene_tree **trees, size_t ntrees, size_t nthreads);
+
+#endif /* MERGE_H */
@@ -0,0 +1,65 @@
+/* include/multisearch.h
+ *
+ * Aho-Corasick search for many patterns in one pass over each sequence
+ */
+
+#ifndef MULTI_SEARCH_H
+#define MULTI_SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <genetree.h>
+#include <mapfile.h>
+#include <search.h>
+
+/*
+ * struct pattern_set : patterns compiled into a single automaton
+ *
+ * Bytes are first mapped to a small alphabet of the characters that occur
+ * in some pattern, with everything else sharing class 0, so for DNA the
+ * transition table has five columns rather than 256 and stays in cache.
+ * Transitions are complete (failure links are folded in at build time),
+ * so matching costs one table lookup per byte of input.
+ */
+
+struct pattern_set {
+	uint8_t classes[256]; /* byte -> alphabet class */
+	size_t nclasses;
+
+	uint32_t *delta; /* nstates * nclasses transitions */
+	int32_t *output; /* first pattern ending at each state, or -1 */
+	uint32_t *report; /* nearest state on the failure chain with output, or 0 */
+	size_t nstates;
+
+	/* patterns, pointing into MAP */
+	const char **names;
+	size_t *name_lens;
+	size_t *lengths;
+	int32_t *next_same; /* next pattern with the same string, or -1 */
+	size_t npatterns;
+
+	struct gene_map *map;
+};
+
+/*
+ * struct multi_search : state of one search-seq-multi, for search_tree()
+ */
+
+struct multi_search {
+	struct search_result result;
+
+	const struct pattern_set *patterns;
+};
+
+/* Compile the patterns in FILENAME: either FASTA, named by deflines, or
+   one pattern per line. Return NULL on failure. */
+struct pattern_set *load_patterns (const char *filename);
+
+void free_patterns (struct pattern_set *patterns);
+
+/* search_tree() callback: ARG is a struct multi_search.
+   Return number of matches in NODE, or -1 if its sequence can't be read. */
+int search_patterns (const struct gene_node *node, void *arg);
+
+#endif /* MULTI_SEARCH_H */
@@ -0,0 +1,47 @@
+/* include/packseq.h
+ *
+ * 2-bit nucleotide packing for gene_node sequences
+ */
+
+#ifndef PACK_SEQ_H
+#define PACK_SEQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arena.h>
+
+/* run of LEN bases starting at POS. BASE is only used for exceptions */
+struct seq_run {
+	size_t pos;
+	size_t len;
+	char base;
+};
+
+/*
+ * struct packed_seq : sequence stored at 2 bits per base
+ *
+ * A, C, G and T are packed four to a byte, least significant bits first.
+ * Anything else (N and the other IUPAC codes) is recorded as a run in
+ * EXCEPTIONS and packed as A, and lowercase (soft-masked) stretches are
+ * recorded as runs in MASKS, so unpacking reproduces the input exactly.
+ */
+
+struct packed_seq {
+	size_t nexceptions;
+	size_t nmasks;
+
+	struct seq_run *exceptions;
+	struct seq_run *masks;
+
+	uint8_t bits[];
+};
+
+/* Pack the LEN bytes at SEQUENCE into ARENA. Returns NULL if the sequence
+   isn't nucleotides, wouldn't be any smaller packed, or on failure. */
+struct packed_seq *pack_sequence (struct arena *arena, const char *sequence, size_t len);
+
+/* Unpack COUNT bases starting at FROM into OUT, which is not null-terminated. */
+void unpack_sequence (const struct packed_seq *packed, size_t from, size_t count, char *out);
+
+#endif /* PACK_SEQ_H */
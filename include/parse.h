@@ -0,0 +1,47 @@
+/* include/parse.h
+ *
+ * FASTA parsing into flat record lists, optionally split across threads
+ */
+
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stddef.h>
+
+struct lazy_seq;
+
+/* one defline/sequence pair, as slices of the input (see struct gene_node) */
+struct gene_record {
+	const char *defline;
+	const char *sequence;
+
+	size_t defline_len;
+	size_t sequence_len;
+
+	struct lazy_seq *lazy; /* set if SEQUENCE is left in the file */
+};
+
+struct record_list {
+	struct gene_record *records;
+	size_t size;
+	size_t capacity;
+};
+
+/* Parse [BEGIN, END) into LIST, appending records in file order. Wrapped
+   sequence lines are joined in place, so the input must be writable.
+   Return 0 on success, -1 on failure. */
+int parse_records (char *begin, char *end, struct record_list *list);
+
+/* Split [BEGIN, END) into at most NTHREADS chunks starting on record
+   boundaries and parse them concurrently. On success *LISTS holds one
+   record list per chunk, in file order, and the number of lists is returned;
+   -1 is returned on failure. */
+long parse_records_parallel (char *begin, char *end, size_t nthreads,
+			     struct record_list **lists);
+
+void free_record_lists (struct record_list *lists, size_t nlists);
+
+/* number of online processors, used when no thread count is given */
+size_t default_thread_count (void);
+
+#endif /* PARSE_H */
@@ -0,0 +1,56 @@
+/* include/region.h
+ *
+ * subsequences of records, named as ID:START-END or read from BED files
+ */
+
+#ifndef REGION_H
+#define REGION_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <genetree.h>
+
+/* longest stretch of a sequence fetched at once while printing a region */
+#define REGION_CHUNK (1 << 20)
+
+/*
+ * struct region : a slice of the record whose key is ID
+ *
+ * START and END are 0-based and half-open, whichever way the region was
+ * written; END is REGION_END when it runs to the end of the sequence.
+ * ID points into the string the region was parsed from and is not
+ * null-terminated.
+ */
+
+#define REGION_END ((size_t) -1)
+
+struct region {
+	const char *id;
+	size_t id_len;
+	size_t start;
+	size_t end;
+	int reverse; /* print the reverse complement */
+};
+
+/* Parse STRING as ID, ID:START or ID:START-END, counting bases from 1 and
+   including END, as samtools does. Commas in numbers are ignored. IDs may
+   themselves contain colons: only the text after the last one is read as
+   a range, and only if it is made of digits, commas and dashes. Return 0
+   on success, -1 if STRING is malformed. */
+int region_parse (const char *string, struct region *region);
+
+/* Parse LINE, a line of a BED file, as a region: fields are separated by
+   tabs, START is 0-based, END is exclusive and a sixth field of `-' asks
+   for the reverse strand. Return 0 on success, 1 if LINE is blank, a
+   comment or a header, and -1 if LINE is malformed. */
+int region_parse_bed (const char *line, struct region *region);
+
+/* Print REGION of NODE to STREAM as a FASTA record named after it, the
+   sequence on one line, fetching no more than REGION_CHUNK bases at a
+   time. END is clipped to the sequence length. Return 0 on success, -1
+   (having said why) if REGION starts beyond the sequence or it can't be
+   read. */
+int region_print (const struct region *region, const struct gene_node *node, FILE *stream);
+
+#endif /* REGION_H */
@@ -0,0 +1,39 @@
+/* include/scan.h
+ *
+ * block-wise scanning for line and record boundaries
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * struct line_scanner : cursor over the newlines in a range
+ *
+ * Input is examined 64 bytes at a time (AVX2 or SSE2 where the CPU has
+ * it, plain C otherwise) and the newlines found are handed out one by one
+ * from a bitmask, so short lines cost a bit-scan rather than a byte loop.
+ */
+
+struct line_scanner {
+	const char *block; /* start of the block MASK describes */
+	const char *end;
+
+	uint64_t mask; /* newlines in BLOCK not yet returned */
+};
+
+void line_scanner_init (struct line_scanner *scanner, const char *begin, const char *end);
+
+/* Return the next newline, or END if there are none left. */
+const char *line_scanner_next (struct line_scanner *scanner);
+
+/* Return the first '>' in [BEGIN, END) immediately preceded by a newline
+   which is itself in [BEGIN, END), or END if there is none. */
+const char *scan_record_start (const char *begin, const char *end);
+
+/* Bitmask of the bytes equal to C in the 64 bytes at P. */
+uint64_t scan_eq_mask64 (const char *p, char c);
+
+#endif /* SCAN_H */
@@ -0,0 +1,82 @@
+/* include/search.h
+ *
+ * substring search over gene_tree deflines and sequences
+ */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <genetree.h>
+
+/* returned by find_substring() when there is no match */
+#define NO_MATCH ((size_t) -1)
+
+#define SEARCH_OUT_SIZE (1 << 16)
+
+/* output buffer, so each match costs a memcpy rather than a stdio call */
+struct search_out {
+	FILE *stream;
+	size_t len;
+	char buf[SEARCH_OUT_SIZE];
+};
+
+/*
+ * struct search_result : where a search writes its matches, and their count
+ *
+ * Every search's state begins with one of these, so that search_tree()
+ * can give each thread a private copy and combine them afterwards.
+ */
+
+struct search_result {
+	struct search_out *out;
+
+	long nrecords; /* records with at least one match */
+	long nmatches; /* total occurrences, overlapping ones included */
+};
+
+/*
+ * struct substring_search : state of one search-label/search-seq
+ *
+ * Passed as the argument of search_tree(); every occurrence of PATTERN
+ * is written to RESULT.OUT, and counted.
+ */
+
+struct substring_search {
+	struct search_result result;
+
+	const char *pattern;
+	size_t pattern_len;
+};
+
+/* Return offset of the first occurrence of NEEDLE in HAYSTACK at or after
+   FROM, or NO_MATCH. */
+size_t find_substring (const char *haystack, size_t haystack_len,
+		       const char *needle, size_t needle_len, size_t from);
+
+/* search_tree() callbacks: ARG is a struct substring_search.
+   Return number of occurrences in NODE, or -1 if its sequence can't be read. */
+int search_defline (const struct gene_node *node, void *arg);
+int search_sequence (const struct gene_node *node, void *arg);
+
+/* Write the "Match found" line introducing NODE's matches. */
+void search_write_record (struct search_out *out, const struct gene_node *node);
+
+/* Set [*BEGIN, *END) to the bytes of a sequence of SEQ_LEN bytes shown
+   around a match of LEN bytes at AT. */
+void search_context (size_t seq_len, size_t at, size_t len, size_t *begin, size_t *end);
+
+/* Write one match line, ending with NOTE unless it is NULL. CONTEXT holds
+   bytes [BEGIN, END) of the sequence, as given by search_context(). */
+void search_write_match (struct search_out *out, const char *context, size_t begin, size_t end,
+			 size_t seq_len, size_t at, size_t len, const char *note);
+
+void search_out_init (struct search_out *out, FILE *stream);
+void search_out_write (struct search_out *out, const char *data, size_t len);
+/* write N in decimal */
+void search_out_number (struct search_out *out, size_t n);
+void search_out_flush (struct search_out *out);
+
+#endif /* SEARCH_H */
@@ -0,0 +1,54 @@
+/* include/seqcache.h
+ *
+ * memory-budgeted cache of sequences read lazily from their files
+ */
+
+#ifndef SEQ_CACHE_H
+#define SEQ_CACHE_H
+
+#include <stddef.h>
+
+#include <genetree.h>
+
+/*
+ * The sequence cache
+ *
+ * Holds whole sequences of lazily read nodes, so that once read they are
+ * served from memory rather than from the file. Only reading a whole
+ * sequence puts it in the cache; a slice of one that isn't cached is read
+ * from the file on its own. The bytes held never exceed a limit:
+ * sequences are evicted least recently used first to make room, and one
+ * larger than a SEQ_CACHE_SHARE-th of the limit is never cached at all,
+ * since it would evict most of the others. A sequence is pinned while a
+ * thread may still be using the bases it was given, and is not evicted
+ * until then. The cache is off, its limit 0, by default.
+ */
+
+#define SEQ_CACHE_SHARE 8
+
+struct seq_cache_stats {
+	size_t limit;
+	size_t used; /* bytes of sequence held */
+	size_t entries;
+
+	unsigned long hits;
+	unsigned long misses; /* lookups read from the file instead */
+	unsigned long evictions;
+};
+
+/* Hold up to LIMIT bytes of sequence, evicting to fit; 0 turns the cache off. */
+void seq_cache_set_limit (size_t limit);
+
+/* Return the LEN-base sequence at LAZY from the cache, reading it in
+   first if it is missing and LOAD is set. It stays valid until the next
+   call on this thread. Return NULL if the sequence is not cached and
+   isn't to be or can't be, or on failure, for the caller to read what it
+   needs itself. */
+const char *seq_cache_get (struct lazy_seq *lazy, size_t len, int load);
+
+/* Forget every sequence read from FD, before FD is closed. */
+void seq_cache_drop (int fd);
+
+void seq_cache_stats (struct seq_cache_stats *stats);
+
+#endif /* SEQ_CACHE_H */
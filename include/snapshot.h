@@ -0,0 +1,56 @@
+/* include/snapshot.h
+ *
+ * binary snapshots of gene_trees, for reloading without parsing
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include <genetree.h>
+
+#define SNAPSHOT_MAGIC "FPSNAP1"
+#define SNAPSHOT_VERSION 1
+
+/*
+ * Snapshot layout
+ *
+ * A struct snapshot_header, then every record in genecmp() order: its
+ * defline and sequence lengths as two uint64_ts, the defline, then the
+ * sequence as text, padded with zeros to a multiple of 8 bytes. Then the
+ * footer index, one uint64_t per record giving the offset of its lengths,
+ * and last a struct snapshot_trailer saying where that index starts.
+ * Integers are in host byte order; a snapshot is for reloading on the
+ * machine that saved it, not for interchange.
+ *
+ * Loading maps the file and points the nodes at the records in place, so
+ * it costs one pass over the index and the deflines, whatever the size
+ * of the sequences.
+ */
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags; /* none yet: 0 */
+	uint64_t nrecords;
+	uint64_t reserved[2];
+};
+
+struct snapshot_trailer {
+	uint64_t index_offset;
+	uint64_t nrecords;
+	char magic[8];
+};
+
+/* Write every record of TREE to FILENAME as a snapshot. Packed and lazy
+   sequences are saved as text. Return the number of records saved, or -1
+   on failure. */
+long snapshot_save (const struct gene_tree *tree, const char *filename);
+
+/* Fill empty TREE from the snapshot FILENAME. Return 0 on success, -1
+   (having said why) if FILENAME is not a snapshot this build can read, or
+   on failure. */
+int snapshot_load (struct gene_tree *tree, const char *filename);
+
+#endif /* SNAPSHOT_H */
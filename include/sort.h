@@ -0,0 +1,21 @@
+/* include/sort.h
+ *
+ * sorting parsed records into genecmp() order for bulk loading
+ */
+
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+
+#include <parse.h>
+
+/* Sort RECS by defline, in the same order as genecmp(). */
+void sort_records (struct gene_record **recs, size_t n);
+
+/* Drop all but one of each run of equal deflines in sorted RECS, keeping
+   the one earliest in its input (lowest defline address), as repeated
+   gene_tree_insert() would. Return the number of records left. */
+size_t unique_records (struct gene_record **recs, size_t n);
+
+#endif /* SORT_H */
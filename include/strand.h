@@ -0,0 +1,56 @@
+/* include/strand.h
+ *
+ * IUPAC-aware sequence search on one or both strands
+ */
+
+#ifndef STRAND_H
+#define STRAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <genetree.h>
+#include <search.h>
+
+/* longest pattern accepted, so per-sequence state fits on the stack */
+#define STRAND_MAX_LEN 4096
+
+/*
+ * struct strand_search : state of one search-seq in iupac or both mode
+ *
+ * The pattern, and for BOTH_STRANDS its reverse complement, are compiled
+ * into shift-and tables: MASKS[s][c * NWORDS + w] has bit i set where
+ * byte c of the sequence is allowed at pattern position 64w + i on
+ * strand s. Each sequence is then read once, advancing one bit-vector
+ * per strand. Ambiguity codes in the pattern match any base they stand
+ * for, and bases match in either case, so soft-masked sequence is found.
+ */
+
+struct strand_search {
+	struct search_result result;
+
+	const char *pattern;
+	size_t pattern_len;
+	int both_strands;
+
+	size_t nwords;
+	uint64_t *masks[2];
+};
+
+/* Prepare SEARCH for PATTERN, on the forward strand only unless
+   BOTH_STRANDS. Return 0 on success, -1 on failure. */
+int strand_init (struct strand_search *search, const char *pattern, size_t len,
+		 int both_strands, struct search_out *out);
+
+void strand_free (struct strand_search *search);
+
+/* search_tree() callback: ARG is a struct strand_search. Matches are
+   reported by forward-strand offset, marked (+) or (-).
+   Return number of matches in NODE, or -1 if its sequence can't be read. */
+int search_strands (const struct gene_node *node, void *arg);
+
+/* Write the reverse complement of the LEN bytes at SRC to DEST, keeping
+   case; bytes that aren't nucleotide codes are reversed unchanged. */
+void reverse_complement (char *dest, const char *src, size_t len);
+
+#endif /* STRAND_H */
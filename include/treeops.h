@@ -7,20 +7,87 @@
 #ifndef TREE_OPS_H
 #define TREE_OPS_H
 
+#include <stdio.h>
+
 #include <genetree.h>
+#include <writer.h>
+
+/*
+ * struct tree_cursor : in-order or pre-order iterator over a gene_tree
+ *
+ * Holds the nodes still to be visited on an explicit stack, so walking
+ * the tree never recurses however deep it is. In order, the stack is the
+ * path from the root to the next node; in pre-order, it holds the right
+ * children passed on the way down. Either way it grows with the height of
+ * the tree, never its size.
+ */
+
+enum cursor_order {
+	CURSOR_IN_ORDER,
+	CURSOR_PRE_ORDER
+};
+
+struct tree_cursor {
+	struct gene_node **stack;
+	size_t depth;
+	size_t capacity;
+	enum cursor_order order;
+};
+
+/* Position CURSOR before the first node of GENE_TREE, in defline order.
+   Return 0 on success, -1 on failure. */
+int cursor_init (struct tree_cursor *cursor, const struct gene_tree *gene_tree);
+
+/* Position CURSOR at the root of GENE_TREE, to visit each node before its
+   subtrees. Return 0 on success, -1 on failure. */
+int cursor_init_preorder (struct tree_cursor *cursor, const struct gene_tree *gene_tree);
+
+/* Position CURSOR before the first node of GENE_TREE whose defline is not
+   less than the LEN bytes at KEY. Return 0 on success, -1 on failure. */
+int cursor_seek (struct tree_cursor *cursor, const struct gene_tree *gene_tree,
+		 const char *key, size_t len);
 
-int fill_tree (struct gene_tree *gene_tree);
+/* Return the next node in CURSOR's order, or NULL at the end. */
+struct gene_node *cursor_next (struct tree_cursor *cursor);
+
+void cursor_free (struct tree_cursor *cursor);
+
+int fill_tree (struct gene_tree *gene_tree, size_t nthreads, int lazy);
 
 int merge_tree (struct gene_tree *src_tree, struct gene_tree *dest_tree);
 
-void print_tree (const struct gene_node *gene_node, FILE *stream);
+long pack_tree (struct gene_tree *gene_tree);
+
+/* Drop the sequences of GENE_TREE from memory, leaving them to be read
+   lazily from its file through the file's index, built if need be. Only a
+   buffer read in full from one plain FASTA file can be. Return 1 if they
+   were dropped, 0 if they can't be, -1 on failure. */
+int evict_tree (struct gene_tree *gene_tree);
+
+void print_node (const struct gene_node *gene_node, FILE *stream);
+
+/* Print the deflines of GENE_TREE in order. Return 0 on success, -1 on failure. */
+int print_tree (const struct gene_tree *gene_tree, FILE *stream);
+
+/* Queue the records of GENE_TREE in order on WRITER. Return 0 on success,
+   -1 on failure. */
+int print_tree_full (const struct gene_tree *gene_tree, struct record_writer *writer);
+
+/* Call NODE_OP on every node of GENE_TREE, on up to NTHREADS threads,
+   so NODE_OP must be safe to call concurrently. Return 0 on success,
+   -1 on failure. */
+int operate_tree (const struct gene_tree *gene_tree,
+		  void (*node_op)(const struct gene_node *), size_t nthreads);
 
-void print_tree_full (const struct gene_node *root, FILE *stream);
+/* Call SEARCH_FN on every node of GENE_TREE, on up to NTHREADS threads.
+   ARG begins with a struct search_result and is ARG_SIZE bytes long; see
+   walk_tree(). Return the number of nodes for which SEARCH_FN reports a
+   match, or -1 on failure. */
+long search_tree (const struct gene_tree *gene_tree, void *arg, size_t arg_size,
+		  int (*search_fn)(const struct gene_node *, void *), size_t nthreads);
 
-void operate_tree (const struct gene_node *root,
-		   void (*node_op)(char *, char *));
+long print_prefix (const struct gene_tree *gene_tree, const char *prefix, FILE *stream);
 
-int search_tree (const struct gene_node *root, const char *string,
-		 int (*search_fn)(const char *, const char *, const char *));
+long print_range (const struct gene_tree *gene_tree, const char *from, const char *to, FILE *stream);
 
 #endif /* TREE_OPS_H */
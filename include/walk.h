@@ -0,0 +1,34 @@
+/* include/walk.h
+ *
+ * parallel traversal of a gene_tree, with work stealing
+ */
+
+#ifndef WALK_H
+#define WALK_H
+
+#include <stddef.h>
+
+#include <genetree.h>
+
+/*
+ * walk_tree() : call VISIT on every node of TREE, on up to NTHREADS threads
+ *
+ * The nodes are laid out in defline order and dealt to the threads as
+ * contiguous ranges. A thread that runs out steals the back half of the
+ * largest range left, so long sequences bunched in one part of the tree
+ * don't leave the other threads idle.
+ *
+ * If ARG_SIZE is 0, ARG is shared by every thread and VISIT must be safe
+ * to call concurrently. Otherwise ARG begins with a struct search_result,
+ * and each thread works on a private copy of its ARG_SIZE bytes. Output
+ * is captured per range and written to ARG's output in defline order, and
+ * the counts are added to ARG's, so results don't depend on NTHREADS.
+ *
+ * Return the number of nodes for which VISIT returned more than 0, or -1
+ * on failure, including VISIT returning less than 0.
+ */
+
+long walk_tree (const struct gene_tree *tree, int (*visit)(const struct gene_node *, void *),
+		void *arg, size_t arg_size, size_t nthreads);
+
+#endif /* WALK_H */
@@ -0,0 +1,68 @@
+/* include/writer.h
+ *
+ * FASTA output straight to a file descriptor, for write and print-all
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+
+#include <sys/uio.h>
+
+#include <genetree.h>
+
+#define WRITER_BUF_SIZE (1 << 22)
+#define WRITER_ALIGN 4096
+#define WRITER_IOV 64
+
+/* sequences at least this long are written from where they lie, not copied */
+#define WRITER_ZERO_COPY_MIN (1 << 16)
+
+/*
+ * struct record_writer : batches records into writev() calls
+ *
+ * Every length is already known, so a record costs a few memcpy()s into
+ * BUF and no formatting. Unwrapped text sequences of WRITER_ZERO_COPY_MIN
+ * bytes or more are not copied at all: an iovec points at them where they
+ * lie, in the mapped input or the arena. Packed sequences are unpacked
+ * straight into BUF.
+ *
+ * With DIRECT, the descriptor was opened with O_DIRECT, so the page cache
+ * is bypassed: all output then goes through BUF, which is aligned and
+ * only written out in whole blocks until the final, partial one.
+ *
+ * With BGZF_THREADS, output is compressed as BGZF, a full BUF at a time,
+ * on that many threads, and ends with the BGZF end-of-file block.
+ */
+
+struct record_writer {
+	int fd;
+	size_t wrap; /* bases per sequence line, 0 for one line */
+	int direct;
+	size_t bgzf_threads; /* 0 for plain text */
+	int error; /* errno of the first failed write, 0 if none */
+
+	char *buf; /* WRITER_BUF_SIZE bytes, aligned to WRITER_ALIGN */
+	size_t len;
+	size_t queued; /* BUF[0, QUEUED) is already in IOV */
+
+	char *zbuf; /* compressed BUF, if BGZF_THREADS */
+
+	struct iovec iov[WRITER_IOV];
+	int niov;
+};
+
+/* Prepare WRITER to write to FD. DIRECT and BGZF_THREADS may not both be
+   set. Return 0 on success, -1 on failure. */
+int writer_init (struct record_writer *writer, int fd, size_t wrap, int direct,
+		 size_t bgzf_threads);
+
+/* Queue NODE's defline and sequence. Return 0 on success, -1 on failure. */
+int writer_record (struct record_writer *writer, const struct gene_node *node);
+
+/* Write everything queued and release WRITER's buffer, but leave FD open.
+   Return 0 if every write succeeded, -1 otherwise, with errno set. */
+int writer_finish (struct record_writer *writer);
+
+#endif /* WRITER_H */
@@ -0,0 +1,214 @@
+/* approx.c - bit-parallel approximate matching (Myers 1999, Hyyro 2003) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <approx.h>
+#include <genetree.h>
+#include <search.h>
+
+static int advance_block (uint64_t *pv, uint64_t *mv, uint64_t eq, int hin, uint64_t high);
+static size_t match_start (const struct approx_search *search, const char *sequence,
+			   size_t end, size_t distance);
+static void report (struct approx_search *search, const struct gene_node *node,
+		    const char *sequence, size_t end, size_t distance, int first);
+
+int approx_init (struct approx_search *search, const char *pattern, size_t len,
+		 size_t max_edits, struct search_out *out)
+{
+	if (len == 0 || len > APPROX_MAX_LEN) {
+		fprintf(stderr, "error: pattern must be 1 to %d bytes long\n", APPROX_MAX_LEN);
+		return -1;
+	}
+	else if (max_edits >= len) {
+		fputs("error: edit limit must be less than the pattern length\n", stderr);
+		return -1;
+	}
+
+	search->pattern = pattern;
+	search->pattern_len = len;
+	search->max_edits = max_edits;
+	search->nwords = (len + 63) / 64;
+	search->result.out = out;
+	search->result.nrecords = 0;
+	search->result.nmatches = 0;
+
+	if ((search->peq = calloc(256 * search->nwords, sizeof(*search->peq))) == NULL) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		search->peq[(unsigned char) pattern[i] * search->nwords + i / 64] |= (uint64_t) 1 << (i % 64);
+	}
+	return 0;
+}
+
+void approx_free (struct approx_search *search)
+{
+	free(search->peq);
+	search->peq = NULL;
+}
+
+int search_approx (const struct gene_node *node, void *arg)
+{
+	struct approx_search *search = arg;
+	const char *sequence = gene_node_sequence(node);
+	const size_t nwords = search->nwords;
+	const size_t max_edits = search->max_edits;
+	const uint64_t last_high = (uint64_t) 1 << ((search->pattern_len - 1) % 64);
+
+	if (sequence == NULL) {
+		fprintf(stderr, "error: unable to read sequence of %.*s\n",
+			(int) node->defline_len, node->defline);
+		return -1;
+	}
+
+	/* column of the edit distance table, as vertical deltas */
+	uint64_t pv[nwords];
+	uint64_t mv[nwords];
+
+	for (size_t w = 0; w < nwords; w++) {
+		pv[w] = ~(uint64_t) 0;
+		mv[w] = 0;
+	}
+
+	long before = search->result.nmatches;
+	size_t score = search->pattern_len;
+	size_t best = 0, best_end = 0;
+	int in_run = 0;
+
+	for (size_t j = 0; j < node->sequence_len; j++) {
+		const uint64_t *eq = &search->peq[(unsigned char) sequence[j] * nwords];
+
+		/* a match may start anywhere, so the top row stays zero */
+		int h = 0;
+		for (size_t w = 0; w + 1 < nwords; w++) {
+			h = advance_block(&pv[w], &mv[w], eq[w], h, (uint64_t) 1 << 63);
+		}
+		score += advance_block(&pv[nwords - 1], &mv[nwords - 1], eq[nwords - 1], h, last_high);
+
+		if (score <= max_edits) {
+			if (!in_run || score < best) {
+				best = score;
+				best_end = j;
+			}
+			in_run = 1;
+		}
+		else if (in_run) {
+			report(search, node, sequence, best_end, best, search->result.nmatches == before);
+			in_run = 0;
+		}
+	}
+
+	if (in_run) {
+		report(search, node, sequence, best_end, best, search->result.nmatches == before);
+	}
+
+	int nmatches = search->result.nmatches - before;
+	if (nmatches > 0) {
+		++(search->result.nrecords);
+	}
+	return nmatches;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* Advance one 64-row block of the column past a text byte whose pattern
+   matches are EQ, given the horizontal delta HIN entering its top row.
+   Return the horizontal delta leaving the row marked by HIGH. */
+static int advance_block (uint64_t *pv, uint64_t *mv, uint64_t eq, int hin, uint64_t high)
+{
+	uint64_t xv = eq | *mv;
+
+	if (hin < 0) {
+		eq |= 1;
+	}
+
+	uint64_t xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+	uint64_t ph = *mv | ~(xh | *pv);
+	uint64_t mh = *pv & xh;
+	int hout = (ph & high) ? 1 : (mh & high) ? -1 : 0;
+
+	ph <<= 1;
+	mh <<= 1;
+	if (hin < 0) {
+		mh |= 1;
+	}
+	else if (hin > 0) {
+		ph |= 1;
+	}
+
+	*pv = mh | ~(xv | ph);
+	*mv = ph & xv;
+	return hout;
+}
+
+/* Nearest start of an alignment of the pattern ending at END with
+   DISTANCE edits, by dynamic programming backwards from END. */
+static size_t match_start (const struct approx_search *search, const char *sequence,
+			   size_t end, size_t distance)
+{
+	const char *pattern = search->pattern;
+	const size_t len = search->pattern_len;
+	size_t limit = len + distance;
+	uint32_t row[len + 1];
+
+	if (limit > end + 1) {
+		limit = end + 1;
+	}
+
+	/* row[i] : distance between the last I pattern bytes and the last J
+	   text bytes up to END */
+	for (size_t i = 0; i <= len; i++) {
+		row[i] = i;
+	}
+
+	for (size_t j = 1; j <= limit; j++) {
+		char c = sequence[end + 1 - j];
+		uint32_t diag = row[0];
+
+		row[0] = j;
+		for (size_t i = 1; i <= len; i++) {
+			uint32_t up = row[i];
+			uint32_t cost = diag + (pattern[len - i] != c);
+
+			if (up + 1 < cost) {
+				cost = up + 1;
+			}
+			if (row[i - 1] + 1 < cost) {
+				cost = row[i - 1] + 1;
+			}
+			diag = up;
+			row[i] = cost;
+		}
+
+		if (row[len] == distance) {
+			return end + 1 - j;
+		}
+	}
+
+	/* not reached: some alignment within LIMIT has this distance */
+	return end + 1 - limit;
+}
+
+static void report (struct approx_search *search, const struct gene_node *node,
+		    const char *sequence, size_t end, size_t distance, int first)
+{
+	size_t start = match_start(search, sequence, end, distance);
+	size_t begin, stop;
+	char note[32];
+
+	/* first match in this node */
+	if (first) {
+		search_write_record(search->result.out, node);
+	}
+	++(search->result.nmatches);
+
+	search_context(node->sequence_len, start, end + 1 - start, &begin, &stop);
+	snprintf(note, sizeof(note), "(%lu edit%s)", distance, (distance == 1) ? "" : "s");
+	search_write_match(search->result.out, sequence + begin, begin, stop, node->sequence_len,
+			   start, end + 1 - start, note);
+}
@@ -0,0 +1,146 @@
+/* arena.c - block allocator for tree nodes */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arena.h>
+
+/* blocks start small so tiny files stay tiny, and double up to a cap */
+#define BLOCK_MIN ((size_t) 64 << 10)
+#define BLOCK_MAX ((size_t) 4 << 20)
+
+/* every allocation is aligned as strictly as any of these */
+union arena_align {
+	long double ld;
+	long long ll;
+	void *p;
+	void (*fp)(void);
+};
+
+#define ALIGN (sizeof(union arena_align))
+
+struct arena_block {
+	struct arena_block *next;
+
+	size_t size; /* usable bytes in DATA */
+	size_t used;
+
+	union arena_align data[];
+};
+
+static struct arena_block *new_block (size_t size);
+
+void arena_init (struct arena *arena)
+{
+	arena->head = NULL;
+	arena->next_size = BLOCK_MIN;
+	arena->total = 0;
+}
+
+void *arena_alloc (struct arena *arena, size_t size)
+{
+	size = (size + ALIGN - 1) & ~(ALIGN - 1);
+
+	struct arena_block *head = arena->head;
+
+	if (head != NULL && head->size - head->used >= size) {
+		void *ptr = (char *) head->data + head->used;
+		head->used += size;
+		return ptr;
+	}
+
+	/* Oversized requests get a block of their own, placed behind the head
+	   so the space left in the current block isn't thrown away. */
+	if (size > arena->next_size / 4 && head != NULL) {
+		struct arena_block *block = new_block(size);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->used = size;
+		block->next = head->next;
+		head->next = block;
+
+		arena->total += size;
+		return block->data;
+	}
+
+	size_t block_size = (size > arena->next_size) ? size : arena->next_size;
+	struct arena_block *block = new_block(block_size);
+
+	if (block == NULL) {
+		return NULL;
+	}
+	block->used = size;
+	block->next = head;
+	arena->head = block;
+
+	arena->total += block_size;
+	if (arena->next_size < BLOCK_MAX) {
+		arena->next_size *= 2;
+	}
+
+	return block->data;
+}
+
+void *arena_memdup (struct arena *arena, const void *src, size_t len)
+{
+	void *dest = arena_alloc(arena, len);
+
+	if (dest != NULL && len > 0) {
+		memcpy(dest, src, len);
+	}
+	return dest;
+}
+
+void arena_free (struct arena *arena)
+{
+	struct arena_block *block = arena->head;
+
+	while (block != NULL) {
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena_init(arena);
+}
+
+void arena_adopt (struct arena *dest, struct arena *src)
+{
+	if (src->head == NULL) {
+		return;
+	}
+	else if (dest->head == NULL) {
+		*dest = *src;
+	}
+	else {
+		/* keep carving DEST's head; SRC's blocks go behind it */
+		struct arena_block *last = src->head;
+		while (last->next != NULL) {
+			last = last->next;
+		}
+		last->next = dest->head->next;
+		dest->head->next = src->head;
+
+		dest->total += src->total;
+	}
+
+	arena_init(src);
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+static struct arena_block *new_block (size_t size)
+{
+	struct arena_block *block = malloc(sizeof(*block) + size);
+
+	if (block != NULL) {
+		block->next = NULL;
+		block->size = size;
+		block->used = 0;
+	}
+	return block;
+}
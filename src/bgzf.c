@@ -0,0 +1,482 @@
+/* bgzf.c - parallel gzip/BGZF decompression and BGZF compression */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <zlib.h>
+
+#include <bgzf.h>
+
+/* fixed part of a gzip member header, and the trailer (CRC32, ISIZE) */
+#define GZIP_HEADER 12
+#define GZIP_TRAILER 8
+
+/* header of a BGZF block: gzip with one extra field, "BC", holding the
+   block size less one */
+#define BGZF_HEADER 18
+
+/* blocks compressed or inflated per thread before more threads pay off */
+#define BLOCKS_PER_THREAD_MIN 4
+
+const unsigned char bgzf_eof[BGZF_EOF_LEN] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+	0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+/* one BGZF block: its compressed data, and where its contents lie in the
+   uncompressed text. Compressing, DATA_LEN is the whole block's length. */
+struct bgzf_block {
+	const unsigned char *data;
+	size_t data_len;
+
+	size_t raw_offset;
+	uint32_t raw_len;
+	uint32_t crc;
+};
+
+/* blocks [BEGIN, END) for one thread to inflate or deflate */
+struct bgzf_job {
+	struct bgzf_block *blocks;
+	size_t begin;
+	size_t end;
+
+	const char *in; /* compression only */
+	char *out;
+	int status;
+};
+
+static size_t read_le16 (const unsigned char *p);
+static uint32_t read_le32 (const unsigned char *p);
+static void write_le16 (unsigned char *p, size_t n);
+static void write_le32 (unsigned char *p, uint32_t n);
+static size_t bgzf_block_len (const unsigned char *p, size_t len);
+static long bgzf_scan (const unsigned char *in, size_t len, struct bgzf_block **blocks,
+		       size_t *out_len);
+static int run_jobs (struct bgzf_block *blocks, size_t nblocks, const char *in, char *out,
+		     size_t nthreads, void *(*fn)(void *));
+static void *inflate_blocks (void *arg);
+static void *deflate_blocks (void *arg);
+static size_t deflate_block (z_stream *stream, const char *in, size_t len, unsigned char *out,
+			     int level);
+static int inflate_stream (const unsigned char *in, size_t len, char **out, size_t *out_len);
+
+int bgzf_is_gzip (const char *data, size_t len)
+{
+	return len >= GZIP_HEADER + GZIP_TRAILER &&
+		(unsigned char) data[0] == 0x1f && (unsigned char) data[1] == 0x8b;
+}
+
+int bgzf_decompress (const char *in, size_t len, size_t nthreads, char **out, size_t *out_len)
+{
+	const unsigned char *data = (const unsigned char *) in;
+	struct bgzf_block *blocks;
+	size_t total;
+	long nblocks = bgzf_scan(data, len, &blocks, &total);
+
+	/* not BGZF: plain gzip has no block sizes to split on */
+	if (nblocks == -1) {
+		return inflate_stream(data, len, out, out_len);
+	}
+
+	/* one more byte, so an empty result is still a valid allocation */
+	char *buf = malloc(total + 1);
+
+	if (buf == NULL || run_jobs(blocks, nblocks, NULL, buf, nthreads, &inflate_blocks) == -1) {
+		free(buf);
+		free(blocks);
+		return -1;
+	}
+
+	free(blocks);
+	*out = buf;
+	*out_len = total;
+	return 0;
+}
+
+size_t bgzf_bound (size_t len)
+{
+	size_t nblocks = (len + BGZF_BLOCK_DATA - 1) / BGZF_BLOCK_DATA;
+
+	return nblocks * BGZF_BLOCK_MAX;
+}
+
+size_t bgzf_compress (const char *in, size_t len, char *out, size_t nthreads)
+{
+	size_t nblocks = (len + BGZF_BLOCK_DATA - 1) / BGZF_BLOCK_DATA;
+	struct bgzf_block *blocks = malloc((nblocks ? nblocks : 1) * sizeof(*blocks));
+
+	if (blocks == NULL) {
+		return 0;
+	}
+
+	/* each block is compressed into its own BGZF_BLOCK_MAX slot of OUT ... */
+	for (size_t i = 0; i < nblocks; i++) {
+		blocks[i].raw_offset = i * BGZF_BLOCK_DATA;
+		blocks[i].raw_len = (len - i * BGZF_BLOCK_DATA < BGZF_BLOCK_DATA) ?
+			len - i * BGZF_BLOCK_DATA : BGZF_BLOCK_DATA;
+	}
+
+	if (run_jobs(blocks, nblocks, in, out, nthreads, &deflate_blocks) == -1) {
+		free(blocks);
+		return 0;
+	}
+
+	/* ... and the slots then packed together */
+	size_t written = 0;
+
+	for (size_t i = 0; i < nblocks; i++) {
+		memmove(out + written, out + i * BGZF_BLOCK_MAX, blocks[i].data_len);
+		written += blocks[i].data_len;
+	}
+
+	free(blocks);
+	return written;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+static size_t read_le16 (const unsigned char *p)
+{
+	return p[0] | (size_t) p[1] << 8;
+}
+
+static uint32_t read_le32 (const unsigned char *p)
+{
+	return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void write_le16 (unsigned char *p, size_t n)
+{
+	p[0] = n & 0xff;
+	p[1] = (n >> 8) & 0xff;
+}
+
+static void write_le32 (unsigned char *p, uint32_t n)
+{
+	for (int i = 0; i < 4; i++) {
+		p[i] = (n >> (8 * i)) & 0xff;
+	}
+}
+
+/* Return the length of the BGZF block at P, of which LEN bytes are
+   available, or 0 if it is not a complete BGZF block. */
+static size_t bgzf_block_len (const unsigned char *p, size_t len)
+{
+	if (len < GZIP_HEADER || p[0] != 0x1f || p[1] != 0x8b || p[2] != Z_DEFLATED || !(p[3] & 4)) {
+		return 0;
+	}
+
+	size_t xlen = read_le16(p + 10);
+
+	if (GZIP_HEADER + xlen > len) {
+		return 0;
+	}
+
+	/* look for the BC subfield among the extra fields */
+	const unsigned char *field = p + GZIP_HEADER;
+	const unsigned char *end = field + xlen;
+
+	while (end - field >= 4) {
+		size_t field_len = read_le16(field + 2);
+
+		if (field[0] == 'B' && field[1] == 'C' && field_len == 2 && end - field >= 6) {
+			size_t block_len = read_le16(field + 4) + 1;
+
+			if (block_len < GZIP_HEADER + xlen + GZIP_TRAILER || block_len > len) {
+				return 0;
+			}
+			return block_len;
+		}
+		field += 4 + field_len;
+	}
+	return 0;
+}
+
+/* Split [IN, IN + LEN) into BGZF blocks, setting *BLOCKS to a malloc()ed
+   array of them and *OUT_LEN to the size of their contents. Return the
+   number of blocks, or -1 if the input is not all BGZF. */
+static long bgzf_scan (const unsigned char *in, size_t len, struct bgzf_block **blocks,
+		       size_t *out_len)
+{
+	size_t capacity = len / BGZF_BLOCK_MAX + 16;
+	struct bgzf_block *list = malloc(capacity * sizeof(*list));
+	size_t nblocks = 0;
+	size_t total = 0;
+
+	if (list == NULL) {
+		return -1;
+	}
+
+	for (size_t pos = 0; pos < len; ) {
+		size_t block_len = bgzf_block_len(in + pos, len - pos);
+
+		if (block_len == 0) {
+			free(list);
+			return -1;
+		}
+
+		if (nblocks == capacity) {
+			/* need a temporary buffer, since realloc leaves LIST unchanged on failure */
+			struct bgzf_block *tmp = realloc(list, 2 * capacity * sizeof(*tmp));
+			if (tmp == NULL) {
+				free(list);
+				return -1;
+			}
+			list = tmp;
+			capacity *= 2;
+		}
+
+		const unsigned char *block = in + pos;
+		size_t xlen = read_le16(block + 10);
+		struct bgzf_block *b = &list[nblocks++];
+
+		b->data = block + GZIP_HEADER + xlen;
+		b->data_len = block_len - GZIP_HEADER - xlen - GZIP_TRAILER;
+		b->crc = read_le32(block + block_len - 8);
+		b->raw_len = read_le32(block + block_len - 4);
+		b->raw_offset = total;
+
+		total += b->raw_len;
+		pos += block_len;
+	}
+
+	*blocks = list;
+	*out_len = total;
+	return nblocks;
+}
+
+/* Run FN over NBLOCKS BLOCKS, split into contiguous runs for up to NTHREADS
+   threads. Return 0 on success, -1 if any run failed. */
+static int run_jobs (struct bgzf_block *blocks, size_t nblocks, const char *in, char *out,
+		     size_t nthreads, void *(*fn)(void *))
+{
+	if (nthreads > nblocks / BLOCKS_PER_THREAD_MIN) {
+		nthreads = nblocks / BLOCKS_PER_THREAD_MIN;
+	}
+	if (nthreads == 0) {
+		nthreads = 1;
+	}
+
+	struct bgzf_job *jobs = malloc(nthreads * sizeof(*jobs));
+	pthread_t *threads = malloc(nthreads * sizeof(*threads));
+	int status = 0;
+
+	if (jobs == NULL || threads == NULL) {
+		free(jobs);
+		free(threads);
+		return -1;
+	}
+
+	for (size_t i = 0; i < nthreads; i++) {
+		jobs[i].blocks = blocks;
+		jobs[i].begin = nblocks * i / nthreads;
+		jobs[i].end = nblocks * (i + 1) / nthreads;
+		jobs[i].in = in;
+		jobs[i].out = out;
+		jobs[i].status = 0;
+	}
+
+	/* this thread takes the first run itself */
+	size_t started = 1;
+
+	for (; started < nthreads; started++) {
+		if (pthread_create(&threads[started], NULL, fn, &jobs[started]) != 0) {
+			break;
+		}
+	}
+
+	(*fn)(&jobs[0]);
+
+	/* runs whose thread didn't start are done here */
+	for (size_t i = started; i < nthreads; i++) {
+		(*fn)(&jobs[i]);
+	}
+
+	for (size_t i = 1; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (size_t i = 0; i < nthreads; i++) {
+		if (jobs[i].status == -1) {
+			status = -1;
+		}
+	}
+
+	free(jobs);
+	free(threads);
+	return status;
+}
+
+static void *inflate_blocks (void *arg)
+{
+	struct bgzf_job *job = arg;
+	z_stream stream;
+
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+		job->status = -1;
+		return NULL;
+	}
+
+	for (size_t i = job->begin; i < job->end; i++) {
+		struct bgzf_block *block = &job->blocks[i];
+		unsigned char *out = (unsigned char *) job->out + block->raw_offset;
+
+		inflateReset(&stream);
+		stream.next_in = (unsigned char *) block->data;
+		stream.avail_in = block->data_len;
+		stream.next_out = out;
+		stream.avail_out = block->raw_len;
+
+		if (inflate(&stream, Z_FINISH) != Z_STREAM_END || stream.total_out != block->raw_len ||
+		    crc32(crc32(0, Z_NULL, 0), out, block->raw_len) != block->crc) {
+			job->status = -1;
+			break;
+		}
+	}
+
+	inflateEnd(&stream);
+	return NULL;
+}
+
+static void *deflate_blocks (void *arg)
+{
+	struct bgzf_job *job = arg;
+	z_stream stream;
+
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		job->status = -1;
+		return NULL;
+	}
+
+	for (size_t i = job->begin; i < job->end; i++) {
+		struct bgzf_block *block = &job->blocks[i];
+		const char *in = job->in + block->raw_offset;
+		unsigned char *out = (unsigned char *) job->out + i * BGZF_BLOCK_MAX;
+
+		size_t block_len = deflate_block(&stream, in, block->raw_len, out, Z_DEFAULT_COMPRESSION);
+
+		/* incompressible: stored blocks always fit */
+		if (block_len == 0) {
+			block_len = deflate_block(&stream, in, block->raw_len, out, 0);
+		}
+		if (block_len == 0) {
+			job->status = -1;
+			break;
+		}
+		block->data_len = block_len;
+	}
+
+	deflateEnd(&stream);
+	return NULL;
+}
+
+/* Compress the LEN bytes at IN at LEVEL into one BGZF block at OUT.
+   Return the block's length, or 0 if it would not fit. */
+static size_t deflate_block (z_stream *stream, const char *in, size_t len, unsigned char *out,
+			     int level)
+{
+	if (deflateReset(stream) != Z_OK || deflateParams(stream, level, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return 0;
+	}
+
+	stream->next_in = (unsigned char *) in;
+	stream->avail_in = len;
+	stream->next_out = out + BGZF_HEADER;
+	stream->avail_out = BGZF_BLOCK_MAX - BGZF_HEADER - GZIP_TRAILER;
+
+	if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+		return 0;
+	}
+
+	size_t block_len = BGZF_HEADER + stream->total_out + GZIP_TRAILER;
+
+	/* the header is the EOF block's, with this block's size */
+	memcpy(out, bgzf_eof, BGZF_HEADER);
+	write_le16(out + 16, block_len - 1);
+	write_le32(out + block_len - 8, crc32(crc32(0, Z_NULL, 0), (const unsigned char *) in, len));
+	write_le32(out + block_len - 4, len);
+	return block_len;
+}
+
+/* Inflate gzip members [IN, IN + LEN) one after another on this thread,
+   as for bgzf_decompress(). */
+static int inflate_stream (const unsigned char *in, size_t len, char **out, size_t *out_len)
+{
+	z_stream stream;
+	size_t capacity = (len < SIZE_MAX / 4) ? 4 * len : len;
+	size_t total = 0;
+	char *buf = malloc(capacity);
+	int status = Z_OK;
+
+	memset(&stream, 0, sizeof(stream));
+	if (buf == NULL || inflateInit2(&stream, MAX_WBITS + 16) != Z_OK) {
+		free(buf);
+		return -1;
+	}
+
+	stream.next_in = (unsigned char *) in;
+
+	while (len > 0 || status != Z_STREAM_END) {
+		if (total == capacity) {
+			/* need a temporary buffer, since realloc leaves BUF unchanged on failure */
+			char *tmp = realloc(buf, 2 * capacity);
+			if (tmp == NULL) {
+				status = Z_MEM_ERROR;
+				break;
+			}
+			buf = tmp;
+			capacity *= 2;
+		}
+
+		/* zlib counts in unsigned ints */
+		size_t in_chunk = (len < UINT_MAX) ? len : UINT_MAX;
+		size_t out_chunk = (capacity - total < UINT_MAX) ? capacity - total : UINT_MAX;
+
+		stream.avail_in = in_chunk;
+		stream.next_out = (unsigned char *) buf + total;
+		stream.avail_out = out_chunk;
+
+		status = inflate(&stream, Z_NO_FLUSH);
+
+		len -= in_chunk - stream.avail_in;
+		total += out_chunk - stream.avail_out;
+
+		if (status == Z_STREAM_END) {
+			/* another member may follow */
+			if (len == 0) {
+				break;
+			}
+			if (inflateReset(&stream) != Z_OK) {
+				break;
+			}
+			status = Z_OK;
+		}
+		else if (status != Z_OK && !(status == Z_BUF_ERROR && stream.avail_out == 0)) {
+			break;
+		}
+		else if (len == 0 && stream.avail_out != 0) {
+			/* truncated */
+			status = Z_DATA_ERROR;
+			break;
+		}
+	}
+
+	inflateEnd(&stream);
+
+	if (status != Z_STREAM_END) {
+		free(buf);
+		return -1;
+	}
+
+	*out = buf;
+	*out_len = total;
+	return 0;
+}
@@ -1,71 +1,39 @@
-/* dsw.c - implementation of Day-Stout-Warren algorithm for balancing
-   a binary search tree. */
+/* dsw.c - the vine-making phase of the Day-Stout-Warren algorithm, and
+   building a balanced binary search tree from sorted nodes. */
 
 #include <stdlib.h>
 #include <genetree.h>
 
-static void rotate_right (struct gene_node *pivot);
-static void rotate_left (struct gene_node *pivot);
-
-size_t count_ground_leaves (struct gene_tree *tree)
-{
-	
-	size_t tmp = (tree->size) + 1;
-	int count = 0;
-	
-	while ((tmp >>= 1) != 0) {
-		++count;
-	}
-
-	return (tree->size + 1 - (1 << count));
-}
+static void rotate_right (struct gene_node **link);
 
 /* `Unroll' tree into a right-sloping vine */
 void tree_to_vine (struct gene_tree *tree)
 {
-	struct gene_node *curr_node = tree->root;
+	struct gene_node **curr_link = &tree->root;
 
-	while (curr_node != NULL) {
-		while (curr_node->left != NULL) {
-			rotate_right(curr_node);
+	while (*curr_link != NULL) {
+		while ((*curr_link)->left != NULL) {
+			rotate_right(curr_link);
 		}
-		curr_node = curr_node->right;
+		curr_link = &(*curr_link)->right;
 	}
 }
 
-/* 'Roll up' right-sloping vine into balanced binary tree */
- void vine_to_tree (struct gene_tree *tree)
+/* Link the N nodes of sorted array NODES into a perfectly balanced tree
+   and return its root. Recursion depth is logarithmic in N. */
+struct gene_node *build_balanced_tree (struct gene_node **nodes, size_t n)
 {
-	size_t ground_leaves = count_ground_leaves(tree);
-
-	struct gene_node *curr_node = tree->root;
-
-	/* rotate left on odd elements until we have lowest level. */
-	for (size_t i = 0; i < ground_leaves; i++) {
-		rotate_left(curr_node);
-		curr_node = curr_node->right; /* skip even elements */
+	if (n == 0) {
+		return NULL;
 	}
 
-	size_t vine_len = (tree->size) - ground_leaves - 1;
-
-	for (size_t i = vine_len/2; i > 0; i = vine_len/2) {
-		curr_node = tree->root;
-		for (size_t j = 0; j < i; j++) {
-			rotate_left(curr_node);
-			curr_node = curr_node->right;
-		}
-		vine_len = vine_len - i - 1;
-	}
-}
+	size_t mid = n / 2;
+	struct gene_node *root = nodes[mid];
 
-void balance_tree (struct gene_tree *tree)
-{
-	if (tree->root == NULL) {
-		return;
-	}
+	root->left = build_balanced_tree(nodes, mid);
+	root->right = build_balanced_tree(nodes + mid + 1, n - mid - 1);
 
-	tree_to_vine(tree);
-	vine_to_tree(tree);
+	return root;
 }
 
 /********************
@@ -73,70 +41,31 @@ void balance_tree (struct gene_tree *tree)
  ********************/
 
 /*
- * TREE ROTATIONS:
+ * TREE ROTATION:
  *
- * Left rotation on A               Right rotation on B
+ * Right rotation on B
  *
- *    A            B                    B           A
- *   / \          / \                  / \         / \
- *  X   B   =>   A   Z                A   Z   =>  X   B
- *     / \      / \                  / \             / \
- *    Y   Z    X   Y                X   Y           Y   Z
+ *      B           A
+ *     / \         / \
+ *    A   Z   =>  X   B
+ *   / \             / \
+ *  X   Y           Y   Z
  *
  * (X, Y, Z all subtrees)
  *
- * We can implement this in three steps:
- *
- * 1) Swap children of the pivot node
- *
- * 2) Swap A and B
- *
- * 3) Permute X, Y, Z
+ * We implement this by relinking: the node taking the pivot's place is
+ * stored through LINK, the pointer (parent's child or tree root) which
+ * referred to the pivot. Nodes keep their contents, so pointers to a node
+ * remain valid however the tree is rebalanced.
  *
  */
 
-static void rotate_right (struct gene_node *pivot)
-{
-	/* step 1 */
-	struct gene_node *node_tmp = pivot->left;
-	pivot->left = pivot->right;
-	pivot->right = node_tmp;
-
-	/* step 2 */
-	char *pivot_defline = pivot->defline;
-	char *pivot_sequence = pivot->sequence;
-
-	pivot->defline = pivot->right->defline;
-	pivot->sequence = pivot->right->sequence;
-	pivot->right->defline = pivot_defline;
-	pivot->right->sequence = pivot_sequence;
-
-	/* step 3 */
-	node_tmp = pivot->left;
-	pivot->left = pivot->right->left;
-	pivot->right->left = pivot->right->right;
-	pivot->right->right = node_tmp;
-}
-
-static void rotate_left (struct gene_node *pivot)
+static void rotate_right (struct gene_node **link)
 {
-		/* step 1 */
-	struct gene_node *node_tmp = pivot->right;
-	pivot->right = pivot->left;
-	pivot->left = node_tmp;
-
-	/* step 2 */
-	char *pivot_defline = pivot->defline;
-	char *pivot_sequence = pivot->sequence;
-
-	pivot->defline = pivot->left->defline;
-	pivot->sequence = pivot->left->sequence;
-	pivot->left->defline = pivot_defline;
-	pivot->left->sequence = pivot_sequence;
+	struct gene_node *pivot = *link;
+	struct gene_node *child = pivot->left;
 
-	/* step 3 */
-	node_tmp = pivot->right;
-	pivot->right = pivot->left->right;
-	pivot->left->right = pivot->left->left;
-	pivot->left->left = node_tmp;
+	pivot->left = child->right;
+	child->right = pivot;
+	*link = child;
 }
@@ -0,0 +1,431 @@
+/* faidx.c - build, load and read records through a FASTA index */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bgzf.h>
+#include <faidx.h>
+#include <genetree.h>
+#include <mapfile.h>
+#include <parse.h>
+#include <scan.h>
+
+#define FAIDX_MAGIC "#fproc-index"
+
+/* records joined per thread before more threads pay off */
+#define RECORDS_PER_THREAD_MIN 64
+
+/* records [BEGIN, END) of INDEX for one thread to join */
+struct join_job {
+	const struct faidx *index;
+	size_t begin;
+	size_t end;
+
+	char *text;
+	size_t text_len;
+	struct gene_record *records;
+	int status;
+};
+
+static char *index_path (const char *filename);
+static int file_stamp (const char *filename, char *stamp, size_t size);
+static long index_text (const char *begin, const char *end, FILE *out, const char *filename);
+static int parse_entry (const char *line, const char *eol, struct faidx_entry *entry);
+static void *join_records (void *arg);
+
+long faidx_build (const char *filename)
+{
+	char stamp[64];
+	char *path = index_path(filename);
+
+	if (path == NULL || file_stamp(filename, stamp, sizeof(stamp)) == -1) {
+		fprintf(stderr, "unable to open file %s\n", filename);
+		free(path);
+		return -1;
+	}
+
+	struct gene_map *map = map_file(filename);
+
+	if (map == NULL) {
+		free(path);
+		return -1;
+	}
+	else if (bgzf_is_gzip(map->addr, map->len)) {
+		fprintf(stderr, "%s is compressed: only plain FASTA can be indexed\n", filename);
+		unmap_file(map);
+		free(path);
+		return -1;
+	}
+
+	FILE *out = fopen(path, "w");
+
+	if (out == NULL) {
+		fprintf(stderr, "unable to open file %s for writing\n", path);
+		unmap_file(map);
+		free(path);
+		return -1;
+	}
+
+	fprintf(out, "%s %s\n", FAIDX_MAGIC, stamp);
+	long nrecords = index_text(map->addr, map->addr + map->len, out, filename);
+
+	if (fclose(out) != 0 && nrecords != -1) {
+		fprintf(stderr, "error writing %s\n", path);
+		nrecords = -1;
+	}
+	if (nrecords == -1) {
+		/* don't leave a partial index to be picked up later */
+		remove(path);
+	}
+
+	unmap_file(map);
+	free(path);
+	return nrecords;
+}
+
+struct faidx *faidx_load (const char *filename)
+{
+	char stamp[64];
+	char *path = index_path(filename);
+
+	if (path == NULL || file_stamp(filename, stamp, sizeof(stamp)) == -1 || access(path, R_OK) == -1) {
+		free(path);
+		return NULL;
+	}
+
+	struct faidx *index = calloc(1, sizeof(*index));
+
+	if (index == NULL || (index->map = map_file(path)) == NULL) {
+		free(index);
+		free(path);
+		return NULL;
+	}
+
+	const char *text = index->map->addr;
+	const char *end = text + index->map->len;
+	const char *eol = memchr(text, '\n', end - text);
+	size_t magic_len = strlen(FAIDX_MAGIC);
+
+	/* the index must be for the file as it is now */
+	if (eol == NULL || (size_t) (eol - text) != magic_len + 1 + strlen(stamp) ||
+	    memcmp(text, FAIDX_MAGIC, magic_len) != 0 || memcmp(eol - strlen(stamp), stamp, strlen(stamp)) != 0) {
+		fprintf(stderr, "warning: %s is out of date, not used\n", path);
+		faidx_free(index);
+		free(path);
+		return NULL;
+	}
+
+	size_t capacity = 0;
+
+	for (const char *p = eol + 1; p < end && (p = memchr(p, '\n', end - p)) != NULL; p++) {
+		++capacity;
+	}
+
+	if ((index->entries = malloc((capacity ? capacity : 1) * sizeof(*index->entries))) == NULL) {
+		faidx_free(index);
+		free(path);
+		return NULL;
+	}
+
+	for (const char *line = eol + 1; line < end; line = eol + 1) {
+		if ((eol = memchr(line, '\n', end - line)) == NULL ||
+		    parse_entry(line, eol, &index->entries[index->size]) == -1) {
+			fprintf(stderr, "error: %s is corrupt, not used\n", path);
+			faidx_free(index);
+			free(path);
+			return NULL;
+		}
+		++(index->size);
+	}
+
+	free(path);
+	return index;
+}
+
+int faidx_records (const struct faidx *index, char *text, size_t text_len, size_t nthreads,
+		   struct record_list *list)
+{
+	size_t n = index->size;
+
+	if (nthreads > n / RECORDS_PER_THREAD_MIN) {
+		nthreads = n / RECORDS_PER_THREAD_MIN;
+	}
+	if (nthreads == 0) {
+		nthreads = 1;
+	}
+
+	list->records = malloc((n ? n : 1) * sizeof(*list->records));
+	list->size = 0;
+	list->capacity = n;
+
+	struct join_job *jobs = malloc(nthreads * sizeof(*jobs));
+	pthread_t *threads = malloc(nthreads * sizeof(*threads));
+	int status = 0;
+
+	if (list->records == NULL || jobs == NULL || threads == NULL) {
+		free(jobs);
+		free(threads);
+		return -1;
+	}
+
+	for (size_t i = 0; i < nthreads; i++) {
+		jobs[i].index = index;
+		jobs[i].begin = n * i / nthreads;
+		jobs[i].end = n * (i + 1) / nthreads;
+		jobs[i].text = text;
+		jobs[i].text_len = text_len;
+		jobs[i].records = list->records;
+		jobs[i].status = 0;
+	}
+
+	/* this thread takes the first share itself, and any whose thread won't start */
+	size_t started = 1;
+
+	for (; started < nthreads; started++) {
+		if (pthread_create(&threads[started], NULL, &join_records, &jobs[started]) != 0) {
+			break;
+		}
+	}
+	join_records(&jobs[0]);
+	for (size_t i = started; i < nthreads; i++) {
+		join_records(&jobs[i]);
+	}
+	for (size_t i = 1; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (size_t i = 0; i < nthreads; i++) {
+		if (jobs[i].status == -1) {
+			status = -1;
+		}
+	}
+
+	free(jobs);
+	free(threads);
+
+	if (status == 0) {
+		list->size = n;
+	}
+	return status;
+}
+
+int faidx_lazy_records (const struct faidx *index, int fd, struct arena *arena,
+			struct record_list *list)
+{
+	size_t n = index->size;
+	struct lazy_seq *lazy = arena_alloc(arena, (n ? n : 1) * sizeof(*lazy));
+
+	list->records = malloc((n ? n : 1) * sizeof(*list->records));
+	list->size = 0;
+	list->capacity = n;
+
+	if (lazy == NULL || list->records == NULL) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		const struct faidx_entry *entry = &index->entries[i];
+		struct gene_record *rec = &list->records[i];
+
+		lazy[i].fd = fd;
+		lazy[i].line_bases = entry->line_bases;
+		lazy[i].line_width = entry->line_width;
+		lazy[i].offset = entry->offset;
+		lazy[i].cached = NULL;
+
+		rec->defline = entry->defline;
+		rec->defline_len = entry->defline_len;
+		rec->sequence = NULL;
+		rec->sequence_len = entry->length;
+		rec->lazy = &lazy[i];
+	}
+
+	list->size = n;
+	return 0;
+}
+
+void faidx_free (struct faidx *index)
+{
+	if (index != NULL) {
+		free(index->entries);
+		unmap_file(index->map);
+	}
+	free(index);
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* Return FILENAME.fpi, malloc()ed, or NULL if out of memory. */
+static char *index_path (const char *filename)
+{
+	size_t len = strlen(filename);
+	char *path = malloc(len + sizeof(FAIDX_SUFFIX));
+
+	if (path != NULL) {
+		memcpy(path, filename, len);
+		memcpy(path + len, FAIDX_SUFFIX, sizeof(FAIDX_SUFFIX));
+	}
+	return path;
+}
+
+/* Write FILENAME's size and modification time to STAMP, which has room for
+   SIZE bytes. Return 0 on success, -1 if FILENAME can't be examined. */
+static int file_stamp (const char *filename, char *stamp, size_t size)
+{
+	struct stat st;
+
+	if (stat(filename, &st) == -1) {
+		return -1;
+	}
+
+	snprintf(stamp, size, "%jd %jd.%09ld", (intmax_t) st.st_size, (intmax_t) st.st_mtim.tv_sec,
+		 (long) st.st_mtim.tv_nsec);
+	return 0;
+}
+
+/* Write an index line to OUT for each record in [BEGIN, END), reading it as
+   parse_records() does. Return the number of records, or -1 if the text
+   can't be indexed. */
+static long index_text (const char *begin, const char *end, FILE *out, const char *filename)
+{
+	struct line_scanner scanner;
+	const char *curr = begin;
+	long nrecords = 0;
+
+	line_scanner_init(&scanner, begin, end);
+
+	while (curr < end) {
+		const char *eol = line_scanner_next(&scanner);
+
+		if (*curr != '>') {
+			fprintf(stderr, "parse error: sequence found before first description line\n");
+			return -1;
+		}
+
+		const char *defline = curr + 1;
+		size_t defline_len = eol - defline;
+		uint64_t offset = eol + 1 - begin;
+		uint64_t length = 0;
+		size_t line_bases = 0;
+		size_t nlines = 0;
+		int short_line = 0;
+
+		/* every line but the last must be as long as the first */
+		for (curr = eol + 1; curr < end && *curr != '>'; curr = eol + 1) {
+			eol = line_scanner_next(&scanner);
+			size_t line_len = eol - curr;
+
+			if (nlines == 0) {
+				line_bases = line_len;
+			}
+			else if (short_line || line_len > line_bases) {
+				fprintf(stderr, "%s: lines of %.*s are of uneven length: can't index\n",
+					filename, (int) defline_len, defline);
+				return -1;
+			}
+			short_line = (line_len < line_bases);
+
+			length += line_len;
+			++nlines;
+		}
+
+		if (line_bases > UINT32_MAX - 1) {
+			fprintf(stderr, "%s: lines of %.*s are too long to index\n",
+				filename, (int) defline_len, defline);
+			return -1;
+		}
+
+		/* as in parsing, a header with no sequence lines doesn't make a record */
+		if (nlines > 0) {
+			fwrite(defline, 1, defline_len, out);
+			fprintf(out, "\t%" PRIu64 "\t%" PRIu64 "\t%zu\t%zu\n", length, offset,
+				line_bases, line_bases + 1);
+			++nrecords;
+		}
+	}
+
+	return nrecords;
+}
+
+/* Parse the index line [LINE, EOL) into ENTRY. The defline may itself hold
+   tabs, so the fields are found from the end. Return 0 on success, -1 if
+   the line is malformed. */
+static int parse_entry (const char *line, const char *eol, struct faidx_entry *entry)
+{
+	const char *field = eol;
+	uint64_t values[4];
+
+	for (int i = 3; i >= 0; i--) {
+		const char *tab = field - 1;
+
+		while (tab >= line && *tab != '\t') {
+			--tab;
+		}
+		if (tab < line || tab + 1 == field || strspn(tab + 1, "0123456789") != (size_t) (field - tab - 1)) {
+			return -1;
+		}
+
+		values[i] = strtoull(tab + 1, NULL, 10);
+		field = tab;
+	}
+
+	entry->defline = line;
+	entry->defline_len = field - line;
+	entry->length = values[0];
+	entry->offset = values[1];
+	entry->line_bases = values[2];
+	entry->line_width = values[3];
+
+	/* the geometry read_lazy() and join_records() divide by */
+	if (entry->length > 0 && (entry->line_bases == 0 || entry->line_width < entry->line_bases)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* join the wrapped lines of JOB's records in place, and describe them */
+static void *join_records (void *arg)
+{
+	struct join_job *job = arg;
+
+	for (size_t i = job->begin; i < job->end; i++) {
+		const struct faidx_entry *entry = &job->index->entries[i];
+		struct gene_record *rec = &job->records[i];
+		uint64_t bases = entry->line_bases;
+		uint64_t end = entry->offset;
+
+		if (entry->length > 0) {
+			uint64_t last = entry->length - 1;
+			end += last / bases * entry->line_width + last % bases + 1;
+		}
+		if (end > job->text_len) {
+			/* the index doesn't match the text after all */
+			job->status = -1;
+			return NULL;
+		}
+
+		char *sequence = job->text + entry->offset;
+
+		if (entry->line_width != entry->line_bases) {
+			for (uint64_t done = bases; done < entry->length; done += bases) {
+				size_t n = (entry->length - done < bases) ? entry->length - done : bases;
+				memmove(sequence + done, sequence + done / bases * entry->line_width, n);
+			}
+		}
+
+		rec->defline = entry->defline;
+		rec->defline_len = entry->defline_len;
+		rec->sequence = sequence;
+		rec->sequence_len = entry->length;
+		rec->lazy = NULL;
+	}
+	return NULL;
+}
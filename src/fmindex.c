@@ -0,0 +1,432 @@
+/* fmindex.c - FM-index built by SA-IS suffix sorting */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fmindex.h>
+#include <genetree.h>
+#include <scan.h>
+#include <treeops.h>
+
+/* symbols 0 and 1 are reserved, and bytes are numbered from here */
+#define SYM_END 0
+#define SYM_SEPARATOR 1
+#define SYM_FIRST 2
+
+#define EMPTY UINT32_MAX
+
+static int sais (const uint32_t *text, uint32_t *sa, size_t n, size_t nsymbols);
+static void bucket_bounds (const uint32_t *text, size_t n, size_t nsymbols, uint32_t *bkt, int ends);
+static void induce (const uint32_t *text, uint32_t *sa, const uint8_t *stype, size_t n,
+		    size_t nsymbols, uint32_t *bkt);
+static int is_lms (const uint8_t *stype, size_t i);
+static size_t rank (const struct fm_index *index, uint8_t c, size_t row);
+static size_t sampled_before (const struct fm_index *index, size_t row);
+
+struct fm_index *fm_index_build (const struct gene_tree *tree)
+{
+	struct fm_index *index = calloc(1, sizeof(*index));
+	struct tree_cursor cursor;
+	struct gene_node *node;
+
+	if (index == NULL) {
+		return NULL;
+	}
+
+	index->records = malloc((tree->size ? tree->size : 1) * sizeof(*index->records));
+	index->starts = malloc((tree->size ? tree->size : 1) * sizeof(*index->starts));
+
+	if (index->records == NULL || index->starts == NULL || cursor_init(&cursor, tree) == -1) {
+		fm_index_free(index);
+		return NULL;
+	}
+
+	/* first pass: rank records, lay them out, and find the alphabet */
+	size_t len = 0;
+	while ((node = cursor_next(&cursor)) != NULL) {
+		const char *sequence = gene_node_sequence(node);
+
+		if (sequence == NULL) {
+			cursor_free(&cursor);
+			fm_index_free(index);
+			return NULL;
+		}
+		for (size_t i = 0; i < node->sequence_len; i++) {
+			index->symbols[(unsigned char) sequence[i]] = 1;
+		}
+
+		index->records[index->nrecords] = node;
+		index->starts[index->nrecords++] = len;
+		len += node->sequence_len + 1;
+	}
+	cursor_free(&cursor);
+
+	index->nsymbols = SYM_FIRST;
+	for (int c = 0; c < 256; c++) {
+		if (index->symbols[c]) {
+			index->symbols[c] = index->nsymbols++;
+		}
+	}
+
+	/* one symbol per byte, so at most 254 distinct bytes fit */
+	if (index->nsymbols > 256 || len + 1 >= EMPTY) {
+		fputs("error: sequences too large or varied for FM-index\n", stderr);
+		fm_index_free(index);
+		return NULL;
+	}
+
+	/* second pass: the text itself, ending in the unique smallest symbol */
+	index->len = len + 1;
+	uint32_t *text = malloc(index->len * sizeof(*text));
+	uint32_t *sa = malloc(index->len * sizeof(*sa));
+
+	if (text == NULL || sa == NULL) {
+		free(text);
+		free(sa);
+		fm_index_free(index);
+		return NULL;
+	}
+
+	for (size_t r = 0; r < index->nrecords; r++) {
+		const char *sequence = gene_node_sequence(index->records[r]);
+		uint32_t *dest = text + index->starts[r];
+
+		if (sequence == NULL) {
+			free(text);
+			free(sa);
+			fm_index_free(index);
+			return NULL;
+		}
+
+		for (size_t i = 0; i < index->records[r]->sequence_len; i++) {
+			dest[i] = index->symbols[(unsigned char) sequence[i]];
+		}
+		dest[index->records[r]->sequence_len] = SYM_SEPARATOR;
+	}
+	text[len] = SYM_END;
+
+	if (sais(text, sa, index->len, index->nsymbols) == -1) {
+		free(text);
+		free(sa);
+		fm_index_free(index);
+		return NULL;
+	}
+
+	size_t nblocks = index->len / 64 + 1;
+	size_t nsamples = (index->len + FM_SAMPLE - 1) / FM_SAMPLE;
+
+	index->bwt = malloc(nblocks * 64);
+	index->occ = malloc(nblocks * index->nsymbols * sizeof(*index->occ));
+	index->less = calloc(index->nsymbols + 1, sizeof(*index->less));
+	index->sampled = calloc(nblocks, sizeof(*index->sampled));
+	index->sampled_rank = malloc(nblocks * sizeof(*index->sampled_rank));
+	index->samples = malloc(nsamples * sizeof(*index->samples));
+
+	if (index->bwt == NULL || index->occ == NULL || index->less == NULL ||
+	    index->sampled == NULL || index->sampled_rank == NULL || index->samples == NULL) {
+		free(text);
+		free(sa);
+		fm_index_free(index);
+		return NULL;
+	}
+
+	/* BWT, checkpoints and samples in one pass over the suffix array */
+	uint64_t *counts = index->less + 1; /* running count of each symbol */
+	size_t nsampled = 0;
+
+	memset(index->bwt + index->len, 0, nblocks * 64 - index->len);
+
+	for (size_t row = 0; row < nblocks * 64; row++) {
+		if (row % 64 == 0) {
+			size_t block = row / 64;
+
+			for (size_t c = 0; c < index->nsymbols; c++) {
+				index->occ[block * index->nsymbols + c] = (uint32_t) counts[c];
+			}
+			index->sampled_rank[block] = nsampled;
+		}
+		if (row >= index->len) {
+			continue;
+		}
+
+		uint8_t c = (sa[row] == 0) ? SYM_END : text[sa[row] - 1];
+		index->bwt[row] = c;
+		++counts[c];
+
+		if (sa[row] % FM_SAMPLE == 0) {
+			index->sampled[row / 64] |= (uint64_t) 1 << (row % 64);
+			index->samples[nsampled++] = sa[row];
+		}
+	}
+
+	/* turn the symbol counts into LESS */
+	for (size_t c = 1; c <= index->nsymbols; c++) {
+		index->less[c] += index->less[c - 1];
+	}
+
+	free(text);
+	free(sa);
+	return index;
+}
+
+size_t fm_index_count (const struct fm_index *index, const char *pattern, size_t len,
+		       struct fm_range *range)
+{
+	size_t begin = 0;
+	size_t end = index->len;
+
+	/* backward search: rows prefixed by ever longer suffixes of PATTERN */
+	for (size_t i = len; i > 0 && begin < end; i--) {
+		uint8_t c = index->symbols[(unsigned char) pattern[i - 1]];
+
+		if (c == 0) {
+			begin = end = 0;
+			break;
+		}
+		begin = index->less[c] + rank(index, c, begin);
+		end = index->less[c] + rank(index, c, end);
+	}
+
+	range->begin = begin;
+	range->end = (end > begin) ? end : begin;
+	return range->end - range->begin;
+}
+
+size_t fm_index_locate (const struct fm_index *index, size_t row, size_t *offset)
+{
+	size_t steps = 0;
+
+	/* walk back along the text (LF mapping) to a sampled position */
+	while (((index->sampled[row / 64] >> (row % 64)) & 1) == 0) {
+		uint8_t c = index->bwt[row];
+
+		row = index->less[c] + rank(index, c, row);
+		++steps;
+	}
+
+	size_t pos = index->samples[sampled_before(index, row)] + steps;
+
+	/* last record starting at or before POS */
+	size_t lo = 0;
+	size_t hi = index->nrecords;
+
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (index->starts[mid] <= pos) {
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	*offset = pos - index->starts[lo];
+	return lo;
+}
+
+void fm_index_free (struct fm_index *index)
+{
+	if (index != NULL) {
+		free(index->bwt);
+		free(index->occ);
+		free(index->less);
+		free(index->sampled);
+		free(index->sampled_rank);
+		free(index->samples);
+		free(index->records);
+		free(index->starts);
+	}
+	free(index);
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* occurrences of C in rows [0, ROW) of the BWT */
+static size_t rank (const struct fm_index *index, uint8_t c, size_t row)
+{
+	size_t block = row / 64;
+	size_t count = index->occ[block * index->nsymbols + c];
+
+	if (row % 64 != 0) {
+		uint64_t mask = scan_eq_mask64((const char *) index->bwt + block * 64, c);
+		count += __builtin_popcountll(mask & (((uint64_t) 1 << (row % 64)) - 1));
+	}
+	return count;
+}
+
+/* sampled rows before ROW, which is the index of ROW's sample if it has one */
+static size_t sampled_before (const struct fm_index *index, size_t row)
+{
+	size_t block = row / 64;
+	uint64_t mask = index->sampled[block] & (((uint64_t) 1 << (row % 64)) - 1);
+
+	return index->sampled_rank[block] + __builtin_popcountll(mask);
+}
+
+/*
+ * SA-IS (Nong, Zhang and Chan 2009): sort the LMS substrings by induced
+ * sorting, name them, recurse on the names if any two are equal, then
+ * induce the full suffix array from the sorted LMS suffixes. TEXT must
+ * end in a unique symbol 0. Linear time; the recursion works in the
+ * unused part of SA, so beyond SA it needs only the type bits and buckets.
+ */
+static int sais (const uint32_t *text, uint32_t *sa, size_t n, size_t nsymbols)
+{
+	uint8_t *stype = malloc(n);
+	uint32_t *bkt = malloc(nsymbols * sizeof(*bkt));
+
+	if (stype == NULL || bkt == NULL) {
+		free(stype);
+		free(bkt);
+		return -1;
+	}
+
+	/* S-type suffixes are smaller than the next one, L-type larger */
+	stype[n - 1] = 1;
+	for (size_t i = n - 1; i > 0; i--) {
+		stype[i - 1] = text[i - 1] < text[i] ||
+			(text[i - 1] == text[i] && stype[i]);
+	}
+
+	/* sort LMS substrings: seed them at their bucket ends and induce */
+	bucket_bounds(text, n, nsymbols, bkt, 1);
+	for (size_t i = 0; i < n; i++) {
+		sa[i] = EMPTY;
+	}
+	for (size_t i = 1; i < n; i++) {
+		if (is_lms(stype, i)) {
+			sa[--bkt[text[i]]] = i;
+		}
+	}
+	induce(text, sa, stype, n, nsymbols, bkt);
+
+	/* gather the sorted LMS substrings at the front of SA */
+	size_t nlms = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (is_lms(stype, sa[i])) {
+			sa[nlms++] = sa[i];
+		}
+	}
+
+	/* name them, equal substrings getting equal names; no two LMS
+	   positions are adjacent, so POS / 2 is a unique slot */
+	for (size_t i = nlms; i < n; i++) {
+		sa[i] = EMPTY;
+	}
+
+	size_t nnames = 0;
+	uint32_t prev = EMPTY;
+
+	for (size_t i = 0; i < nlms; i++) {
+		uint32_t pos = sa[i];
+		int differ = (prev == EMPTY);
+
+		for (size_t d = 0; !differ; d++) {
+			if (text[pos + d] != text[prev + d] || stype[pos + d] != stype[prev + d]) {
+				differ = 1;
+			}
+			else if (d > 0 && (is_lms(stype, pos + d) || is_lms(stype, prev + d))) {
+				break;
+			}
+		}
+
+		if (differ) {
+			++nnames;
+			prev = pos;
+		}
+		sa[nlms + pos / 2] = nnames - 1;
+	}
+
+	/* pack the names to the end of SA, in text order: the reduced string */
+	uint32_t *reduced = sa + n - nlms;
+	for (size_t i = n, j = n; i > nlms; i--) {
+		if (sa[i - 1] != EMPTY) {
+			sa[--j] = sa[i - 1];
+		}
+	}
+
+	/* order of the LMS suffixes, as ranks into the reduced string */
+	if (nnames < nlms) {
+		if (sais(reduced, sa, nlms, nnames) == -1) {
+			free(stype);
+			free(bkt);
+			return -1;
+		}
+	}
+	else {
+		for (size_t i = 0; i < nlms; i++) {
+			sa[reduced[i]] = i;
+		}
+	}
+
+	/* map ranks back to text positions, and induce the full order */
+	for (size_t i = 1, j = 0; i < n; i++) {
+		if (is_lms(stype, i)) {
+			reduced[j++] = i;
+		}
+	}
+	for (size_t i = 0; i < nlms; i++) {
+		sa[i] = reduced[sa[i]];
+	}
+	for (size_t i = nlms; i < n; i++) {
+		sa[i] = EMPTY;
+	}
+
+	bucket_bounds(text, n, nsymbols, bkt, 1);
+	for (size_t i = nlms; i > 0; i--) {
+		uint32_t pos = sa[i - 1];
+
+		sa[i - 1] = EMPTY;
+		sa[--bkt[text[pos]]] = pos;
+	}
+	induce(text, sa, stype, n, nsymbols, bkt);
+
+	free(stype);
+	free(bkt);
+	return 0;
+}
+
+/* start (or, if ENDS, one past the end) of each symbol's bucket */
+static void bucket_bounds (const uint32_t *text, size_t n, size_t nsymbols, uint32_t *bkt, int ends)
+{
+	uint32_t sum = 0;
+
+	memset(bkt, 0, nsymbols * sizeof(*bkt));
+	for (size_t i = 0; i < n; i++) {
+		++bkt[text[i]];
+	}
+	for (size_t c = 0; c < nsymbols; c++) {
+		sum += bkt[c];
+		bkt[c] = ends ? sum : sum - bkt[c];
+	}
+}
+
+/* place L-type suffixes left to right from the sorted ones, then S-type
+   suffixes right to left */
+static void induce (const uint32_t *text, uint32_t *sa, const uint8_t *stype, size_t n,
+		    size_t nsymbols, uint32_t *bkt)
+{
+	bucket_bounds(text, n, nsymbols, bkt, 0);
+	for (size_t i = 0; i < n; i++) {
+		if (sa[i] != EMPTY && sa[i] > 0 && !stype[sa[i] - 1]) {
+			sa[bkt[text[sa[i] - 1]]++] = sa[i] - 1;
+		}
+	}
+
+	bucket_bounds(text, n, nsymbols, bkt, 1);
+	for (size_t i = n; i > 0; i--) {
+		if (sa[i - 1] != EMPTY && sa[i - 1] > 0 && stype[sa[i - 1] - 1]) {
+			sa[--bkt[text[sa[i - 1] - 1]]] = sa[i - 1] - 1;
+		}
+	}
+}
+
+/* leftmost S-type position of a run */
+static int is_lms (const uint8_t *stype, size_t i)
+{
+	return i != EMPTY && i > 0 && stype[i] && !stype[i - 1];
+}
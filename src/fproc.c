@@ -5,51 +5,117 @@
  *    
  */
 
+/* for O_DIRECT */
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <genetree.h>
 #include <treeops.h>
+#include <approx.h>
+#include <bgzf.h>
+#include <faidx.h>
+#include <merge.h>
+#include <fmindex.h>
+#include <hashindex.h>
+#include <kmerindex.h>
+#include <multisearch.h>
+#include <parse.h>
+#include <region.h>
+#include <snapshot.h>
+#include <search.h>
+#include <seqcache.h>
+#include <strand.h>
 #include <dsw.h>
+#include <writer.h>
 
 /* file array, initialised to array of NULLS by compiler */
 #define FILE_MAX 10
 static struct gene_tree *file_list[FILE_MAX];
 
-/* search functions, passed by reference */
-static int defsearch(const char *defline, const char *sequence, const char *string);
-static int seqsearch(const char *defline, const char *sequence, const char *string);
+/* bytes of memory buffers and cached sequences may use, 0 for no limit */
+static size_t memory_budget;
+
+/* located FM-index match */
+struct fm_hit {
+	size_t record;
+	size_t offset;
+};
+
+/* qsort() comparison of located FM-index matches, by record then offset */
+static int fm_hit_cmp(const void *a, const void *b);
+
+/* write every record of TREE to FD through a record_writer */
+static int write_records(const struct gene_tree *tree, const int fd, const size_t wrap,
+			 const int direct, const size_t bgzf_threads);
+
+/* print REGION of every record of TREE indexed under its ID; return the
+   number printed */
+static int extract_region(struct gene_tree *tree, const struct region *region);
+
+/* bytes of nodes, deflines, file contents and sequences held in memory by TREE */
+static size_t tree_bytes(const struct gene_tree *tree);
 
-/* read from infile, construct tree, and store in FILE_LIST[n] */
-int fproc_read_n(const char *infile, const size_t destN)
+/* tree_bytes() of every buffer */
+static size_t resident_bytes(void);
+
+/* read the sequences of buffers lazily, largest first, until they fit the
+   budget, and give the sequence cache whatever it leaves after them */
+static void update_cache_limit(void);
+
+/* would reading INFILE in full take more memory than the budget has left? */
+static int over_budget(const char *infile);
+
+/* run search_tree() over FILE_LIST[srcN] with SEARCH_FN, reporting matches of STRING;
+   if USE_KMERS, try the buffer's k-mer index first */
+static int run_search(const size_t srcN, const char *string,
+		      int (*search_fn)(const struct gene_node *, void *), const int use_kmers);
+
+/* read from infile using NTHREADS parser threads, construct tree, and store in FILE_LIST[n] */
+int fproc_read_n(const char *infile, const size_t destN, const size_t nthreads, int lazy)
 {
-	if (destN > FILE_MAX) {
-		fprintf(stderr, "error: buffer number %lu is out of bounds", destN + 1);
+	if (destN >= FILE_MAX) {
+		fprintf(stderr, "error: buffer number %lu is out of bounds\n", destN + 1);
 		return -1;
 	}
 	else if (file_list[destN] != NULL) {
 		fprintf(stdout, "read failed: file buffer %lu not empty\n", destN + 1);
 		return 0;
 	}
-	else if ((file_list[destN] = init_gene_tree(infile, strlen(infile))) == NULL) {
+	else if (!lazy && (lazy = over_budget(infile))) {
+		fprintf(stdout, "%s is over the memory budget: reading it lazily\n", infile);
+	}
+
+	if ((file_list[destN] = init_gene_tree(infile, strlen(infile))) == NULL) {
 		fprintf(stderr, "failed to initialise tree for file %s\n", infile);
 		return -1;
 	}
-	else if (fill_tree(file_list[destN]) == -1) {
+	else if (fill_tree(file_list[destN], nthreads, lazy) == -1) {
 		free_gene_tree(file_list[destN]);
 		file_list[destN] = NULL;
 		return -1;
 	}
 	else {
+		update_cache_limit();
 		fprintf(stdout,"file %s successfully stored in buffer %lu\n", infile, destN + 1);
 		return 0;
 	}
 }
 
-/* read from infile, construct tree, and store in next free node */
-int fproc_read(const char *infile)
+/* read from infile using NTHREADS parser threads, construct tree, and store in next free node */
+int fproc_read(const char *infile, const size_t nthreads, int lazy)
 {
+	if (!lazy && (lazy = over_budget(infile))) {
+		fprintf(stdout, "%s is over the memory budget: reading it lazily\n", infile);
+	}
+
 	for (long unsigned int i = 0; i < FILE_MAX; i++) {
 		if (file_list[i] != NULL)
 			continue;
@@ -57,12 +123,13 @@ int fproc_read(const char *infile)
 			fprintf(stderr, "failed to initialise tree for file %s\n", infile);
 			return -1;
 		}
-		else if (fill_tree(file_list[i]) == -1) {
+		else if (fill_tree(file_list[i], nthreads, lazy) == -1) {
 			free_gene_tree(file_list[i]);
 			file_list[i] = NULL;
 			return -1;
 		}
 		else {
+			update_cache_limit();
 			fprintf(stdout, "file %s successfully stored in buffer %lu\n", infile, i + 1);
 			return 0;
 		}
@@ -71,6 +138,65 @@ int fproc_read(const char *infile)
 	return -1;
 }
 
+/* load the snapshot INFILE into the first free buffer */
+int fproc_load(const char *infile)
+{
+	for (long unsigned int i = 0; i < FILE_MAX; i++) {
+		if (file_list[i] != NULL)
+			continue;
+		else if ((file_list[i] = init_gene_tree(infile, strlen(infile))) == NULL) {
+			fprintf(stderr, "failed to initialise tree for file %s\n", infile);
+			return -1;
+		}
+		else if (snapshot_load(file_list[i], infile) == -1) {
+			free_gene_tree(file_list[i]);
+			file_list[i] = NULL;
+			return -1;
+		}
+		else {
+			update_cache_limit();
+			fprintf(stdout, "snapshot %s successfully loaded into buffer %lu\n", infile, i + 1);
+			return 0;
+		}
+	}
+	fprintf(stderr, "could not load snapshot %s: FILE_MAX %d reached\n", infile, FILE_MAX);
+	return -1;
+}
+
+/* save FILE_LIST[srcN] as the snapshot OUTFILE */
+int fproc_save(const size_t srcN, const char *outfile)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	long nrecords = snapshot_save(file_list[srcN], outfile);
+
+	if (nrecords == -1) {
+		return -1;
+	}
+	fprintf(stdout, "saved %ld sequences of buffer %lu to %s\n", nrecords, srcN + 1, outfile);
+	return 0;
+}
+
+/* index infile, writing the index beside it */
+int fproc_index(const char *infile)
+{
+	long nrecords = faidx_build(infile);
+
+	if (nrecords == -1) {
+		return -1;
+	}
+
+	fprintf(stdout, "indexed %ld sequences of %s in %s%s\n", nrecords, infile, infile, FAIDX_SUFFIX);
+	return 0;
+}
+
 /* print deflines from tree in FILE_LIST[n] */
 void fproc_print (const size_t srcN)
 {
@@ -80,20 +206,23 @@ void fproc_print (const size_t srcN)
 		fprintf(stdout, "could not print contents of buffer %lu: buffer is empty\n", srcN + 1);
 	else {
 		struct gene_tree *tmp = file_list[srcN];
-		print_tree(tmp->root, stdout);
+		if (print_tree(tmp, stdout) == -1)
+			fprintf(stderr, "error: out of memory printing buffer %lu\n", srcN + 1);
 	}
 }
 
 /* print deflines and sequences from tree in FILE_LIST[n] */
-void fproc_print_all(const size_t srcN)
+void fproc_print_all(const size_t srcN, const size_t wrap)
 {
 	if (srcN >= FILE_MAX)
 		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
 	else if (file_list[srcN] == NULL)
 		fprintf(stdout, "could not print contents of buffer %lu: buffer is empty\n", srcN + 1);
 	else {
-		struct gene_tree *tmp = file_list[srcN];
-		print_tree_full(tmp->root, stdout);
+		/* the records bypass stdio, so let what it holds go first */
+		fflush(stdout);
+		if (write_records(file_list[srcN], STDOUT_FILENO, wrap, 0, 0) == -1)
+			fprintf(stderr, "error: printing buffer %lu failed: %s\n", srcN + 1, strerror(errno));
 	}
 }
 
@@ -111,27 +240,42 @@ void fproc_list(void)
 }
 
 /* write contents of FILE_ARRAY[n] to outfile */
-int fproc_write(const size_t srcN, const char *outfile)
+int fproc_write(const size_t srcN, const char *outfile, const size_t wrap, const int direct,
+		const size_t bgzf_threads)
 {
 	if (srcN >= FILE_MAX) {
 		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
 		return -1;
 	}
-	
-	FILE *ofptr = fopen(outfile, "w");
-	
-	if (ofptr == NULL) {
+
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	int fd = open(outfile, direct ? flags | O_DIRECT : flags, 0666);
+	int is_direct = direct;
+
+	if (fd == -1 && direct && errno == EINVAL) {
+		/* the filesystem doesn't support O_DIRECT */
+		fprintf(stderr, "warning: %s can't bypass the page cache, writing normally\n", outfile);
+		fd = open(outfile, flags, 0666);
+		is_direct = 0;
+	}
+	if (fd == -1) {
 		fprintf(stderr, "error: unable to open file %s for writing\n", outfile);
 		return -1;
 	}
 
 	if (file_list[srcN] == NULL)
 		fprintf(stdout, "could not write contents of buffer %lu: buffer is empty\n", srcN + 1);
-	else {
-		struct gene_tree *tmp = file_list[srcN];
-		print_tree_full(tmp->root, ofptr);
+	else if (write_records(file_list[srcN], fd, wrap, is_direct, bgzf_threads) == -1) {
+		fprintf(stderr, "error: writing buffer %lu to %s failed: %s\n", srcN + 1, outfile,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (close(fd) == -1) {
+		fprintf(stderr, "error: writing %s failed: %s\n", outfile, strerror(errno));
+		return -1;
 	}
-	fclose(ofptr);
 	return 0;
 }
 
@@ -153,15 +297,305 @@ int fproc_merge(const size_t srcN, const size_t destN)
 		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
 	else if (file_list[destN] == NULL)
 		file_list[destN] = file_list[srcN];
-	else
-		merge_tree(file_list[srcN], file_list[destN]);
+	else if (merge_tree(file_list[srcN], file_list[destN]) == -1)
+		return -1;
 
 	file_list[srcN] = NULL;
 	return 0;
 }
 
-/* search deflines in FILE_LIST[srcN] for string */
-int fproc_search_defline(const size_t srcN, const char *string)
+/* merge FILE_LIST[srcN[1..n-1]] into FILE_LIST[srcN[0]] in a single pass.
+   with no buffers given, merge every loaded buffer into the first */
+int fproc_merge_all(const size_t *srcN, const size_t n, const size_t nthreads)
+{
+	struct gene_tree *trees[FILE_MAX];
+	size_t slots[FILE_MAX];
+	size_t ntrees = 0;
+
+	if (n == 0) {
+		for (size_t i = 0; i < FILE_MAX; i++) {
+			if (file_list[i] != NULL) {
+				slots[ntrees] = i;
+				trees[ntrees++] = file_list[i];
+			}
+		}
+	}
+	else {
+		for (size_t i = 0; i < n; i++) {
+			if (srcN[i] >= FILE_MAX) {
+				fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN[i] + 1);
+				return -1;
+			}
+			else if (file_list[srcN[i]] == NULL) {
+				fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN[i] + 1);
+				return 0;
+			}
+
+			/* ignore repeats, so no tree is merged into itself */
+			int repeat = 0;
+			for (size_t j = 0; j < ntrees; j++) {
+				repeat |= (slots[j] == srcN[i]);
+			}
+			if (!repeat) {
+				slots[ntrees] = srcN[i];
+				trees[ntrees++] = file_list[srcN[i]];
+			}
+		}
+	}
+
+	if (ntrees < 2) {
+		fputs("fewer than two buffers: nothing to do\n", stdout);
+		return 0;
+	}
+	else if (merge_trees(trees, ntrees, nthreads) == -1) {
+		return -1;
+	}
+
+	for (size_t i = 1; i < ntrees; i++) {
+		file_list[slots[i]] = NULL;
+	}
+	fprintf(stdout, "merged %lu buffers into buffer %lu (%lu sequences)\n",
+		ntrees, slots[0] + 1, file_list[slots[0]]->size);
+	return 0;
+}
+
+/* pack sequences in FILE_LIST[srcN] at 2 bits per base */
+int fproc_pack(const size_t srcN)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	struct gene_tree *tmp = file_list[srcN];
+	long npacked = pack_tree(tmp);
+
+	/* the buffer now holds packed sequences rather than its files */
+	update_cache_limit();
+	if (npacked == -1) {
+		fprintf(stderr, "error: failed to pack buffer %lu\n", srcN + 1);
+		return -1;
+	}
+	fprintf(stdout, "packed %ld of %lu sequences in buffer %lu\n", npacked, tmp->size, srcN + 1);
+	return 0;
+}
+
+/* build a hash index over FILE_LIST[srcN] for exact lookup by KEY */
+int fproc_index_label(const size_t srcN, const enum index_key key)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	struct gene_tree *tmp = file_list[srcN];
+	struct gene_index *index = index_build(tmp, key);
+
+	if (index == NULL) {
+		fprintf(stderr, "error: failed to index buffer %lu\n", srcN + 1);
+		return -1;
+	}
+
+	index_free(tmp->index);
+	tmp->index = index;
+
+	fprintf(stdout, "indexed %lu sequences in buffer %lu by %s\n", tmp->size, srcN + 1,
+		(key == INDEX_DEFLINE) ? "description line" : "accession");
+	return 0;
+}
+
+/* index FILE_LIST[srcN] by K-mer for search-seq. If INDEXFILE is given, load
+   the index from it when it matches the buffer, and otherwise save it there */
+int fproc_index_kmer(const size_t srcN, const unsigned k, const char *indexfile)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	struct gene_tree *tmp = file_list[srcN];
+	struct kmer_index *index = NULL;
+
+	if (indexfile != NULL && access(indexfile, F_OK) == 0) {
+		index = kmer_index_load(tmp, indexfile);
+
+		if (index != NULL && index->k != k) {
+			fprintf(stdout, "%s holds a %u-mer index: rebuilding\n", indexfile, index->k);
+			kmer_index_free(index);
+			index = NULL;
+		}
+		else if (index != NULL) {
+			kmer_index_free(tmp->kmers);
+			tmp->kmers = index;
+
+			fprintf(stdout, "loaded %u-mer index of buffer %lu from %s\n", k, srcN + 1, indexfile);
+			return 0;
+		}
+	}
+
+	if ((index = kmer_index_build(tmp, k)) == NULL) {
+		fprintf(stderr, "error: failed to index buffer %lu\n", srcN + 1);
+		return -1;
+	}
+
+	kmer_index_free(tmp->kmers);
+	tmp->kmers = index;
+
+	fprintf(stdout, "indexed %lu %u-mers in buffer %lu\n", index->nhits, k, srcN + 1);
+
+	if (indexfile != NULL) {
+		if (kmer_index_save(index, indexfile) == -1) {
+			return -1;
+		}
+		fprintf(stdout, "index saved to %s\n", indexfile);
+	}
+	return 0;
+}
+
+/* print every record in FILE_LIST[srcN] stored under one of the N IDS,
+   indexing the buffer by accession first if it has no index */
+int fproc_get(const size_t srcN, char *const *ids, const size_t n)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	struct gene_tree *tmp = file_list[srcN];
+
+	if (tmp->index == NULL && (tmp->index = index_build(tmp, INDEX_ACCESSION)) == NULL) {
+		fprintf(stderr, "error: failed to index buffer %lu\n", srcN + 1);
+		return -1;
+	}
+
+	int count = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		size_t cursor = 0;
+		size_t id_len = strlen(ids[i]);
+		struct gene_node *node;
+		int found = 0;
+
+		while ((node = index_find(tmp->index, ids[i], id_len, &cursor)) != NULL) {
+			print_node(node, stdout);
+			++found;
+		}
+
+		if (!found) {
+			fprintf(stdout, "%s: not found\n", ids[i]);
+		}
+		count += found;
+	}
+
+	return count;
+}
+
+/* print the N regions named in REGIONS from FILE_LIST[srcN], reverse
+   complemented if REVCOMP */
+int fproc_extract(const size_t srcN, char *const *regions, const size_t n, const int revcomp)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	int count = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		struct region region;
+
+		if (region_parse(regions[i], &region) == -1) {
+			fprintf(stdout, "%s is not a valid region\n", regions[i]);
+			continue;
+		}
+		region.reverse = revcomp;
+		count += extract_region(file_list[srcN], &region);
+	}
+	return count;
+}
+
+/* print every region listed in BED-format BEDFILE from FILE_LIST[srcN],
+   reverse complemented if REVCOMP or the region is on the - strand */
+int fproc_extract_bed(const size_t srcN, const char *bedfile, const int revcomp)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	FILE *bed = fopen(bedfile, "r");
+	if (bed == NULL) {
+		fprintf(stderr, "error: unable to open %s: %s\n", bedfile, strerror(errno));
+		return -1;
+	}
+
+	char *line = NULL;
+	size_t capacity = 0;
+	size_t lineno = 0;
+	int count = 0;
+
+	while (getline(&line, &capacity, bed) != -1) {
+		struct region region;
+		int status = region_parse_bed(line, &region);
+
+		++lineno;
+		if (status == -1) {
+			fprintf(stdout, "%s:%lu: not a valid BED line\n", bedfile, lineno);
+		}
+		else if (status == 0) {
+			region.reverse |= revcomp;
+			count += extract_region(file_list[srcN], &region);
+		}
+	}
+
+	free(line);
+	fclose(bed);
+	return count;
+}
+
+/* print records in FILE_LIST[srcN] whose deflines start with PREFIX */
+int fproc_prefix(const size_t srcN, const char *prefix)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: source buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+	else {
+		struct gene_tree *tmp = file_list[srcN];
+		return print_prefix(tmp, prefix, stdout);
+	}
+}
+
+/* print records in FILE_LIST[srcN] with deflines from FROM up to but not including TO */
+int fproc_range(const size_t srcN, const char *from, const char *to)
 {
 	if (srcN >= FILE_MAX) {
 		fprintf(stderr, "error: source buffer number %lu is out of bounds\n", srcN + 1);
@@ -173,13 +607,25 @@ int fproc_search_defline(const size_t srcN, const char *string)
 	}
 	else {
 		struct gene_tree *tmp = file_list[srcN];
-		return search_tree(tmp->root, string, &defsearch);
+		return print_range(tmp, from, to, stdout);
 	}
+}
 
+/* search deflines in FILE_LIST[srcN] for string */
+int fproc_search_defline(const size_t srcN, const char *string)
+{
+	return run_search(srcN, string, &search_defline, 0);
 }
 
 /* search sequences in FILE_LIST[srcN] for string */
 int fproc_search_sequence(const size_t srcN, const char *string)
+{
+	return run_search(srcN, string, &search_sequence, 1);
+}
+
+/* search sequences in FILE_LIST[srcN] for IUPAC pattern STRING, and its
+   reverse complement too if BOTH_STRANDS */
+int fproc_search_strands(const size_t srcN, const char *string, const int both_strands)
 {
 	if (srcN >= FILE_MAX) {
 		fprintf(stderr, "error: source buffer number %lu is out of bounds\n", srcN + 1);
@@ -189,11 +635,210 @@ int fproc_search_sequence(const size_t srcN, const char *string)
 		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
 		return 0;
 	}
-	else {
-		struct gene_tree *tmp = file_list[srcN];
-		return search_tree(tmp->root, string, &seqsearch);
+
+	static struct search_out out;
+	struct strand_search search;
+
+	if (strand_init(&search, string, strlen(string), both_strands, &out) == -1) {
+		return -1;
+	}
+
+	search_out_init(&out, stdout);
+	long status = search_tree(file_list[srcN], &search, sizeof(search), &search_strands,
+				  default_thread_count());
+	search_out_flush(&out);
+
+	if (status == -1) {
+		fprintf(stderr, "error: searching buffer %lu failed\n", srcN + 1);
+		strand_free(&search);
+		return -1;
+	}
+
+	fprintf(stdout, "%ld matches in %ld sequences\n", search.result.nmatches, search.result.nrecords);
+
+	strand_free(&search);
+	return search.result.nrecords;
+}
+
+/* count occurrences of STRING in FILE_LIST[srcN]'s sequences with its FM-index,
+   building that first if need be, and list them if LOCATE is set */
+int fproc_search_fm(const size_t srcN, const char *string, const int locate)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: source buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	struct gene_tree *tmp = file_list[srcN];
+
+	if (tmp->fm == NULL) {
+		if ((tmp->fm = fm_index_build(tmp)) == NULL) {
+			fprintf(stderr, "error: failed to build FM-index of buffer %lu\n", srcN + 1);
+			return -1;
+		}
+		fprintf(stdout, "built FM-index of buffer %lu (%lu bases)\n", srcN + 1,
+			tmp->fm->len - tmp->fm->nrecords - 1);
+	}
+
+	struct fm_range range;
+	size_t len = strlen(string);
+	size_t count = fm_index_count(tmp->fm, string, len, &range);
+
+	if (!locate || count == 0) {
+		fprintf(stdout, "%lu matches\n", count);
+		return count;
+	}
+
+	/* occurrences come out in suffix order: sort them by record and offset */
+	struct fm_hit *hits = malloc(count * sizeof(*hits));
+
+	if (hits == NULL) {
+		fputs("error: out of memory locating matches\n", stderr);
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		hits[i].record = fm_index_locate(tmp->fm, range.begin + i, &hits[i].offset);
+	}
+	qsort(hits, count, sizeof(*hits), &fm_hit_cmp);
+
+	static struct search_out out;
+	long nrecords = 0;
+
+	search_out_init(&out, stdout);
+	for (size_t i = 0; i < count; i++) {
+		const struct gene_node *node = tmp->fm->records[hits[i].record];
+		size_t begin, end;
+
+		if (i == 0 || hits[i].record != hits[i - 1].record) {
+			search_write_record(&out, node);
+			++nrecords;
+		}
+
+		search_context(node->sequence_len, hits[i].offset, len, &begin, &end);
+
+		const char *context = gene_node_window(node, begin, end - begin);
+		if (context != NULL) {
+			search_write_match(&out, context, begin, end, node->sequence_len,
+					   hits[i].offset, len, NULL);
+		}
 	}
+	search_out_flush(&out);
 
+	fprintf(stdout, "%lu matches in %ld sequences\n", count, nrecords);
+	free(hits);
+	return count;
+}
+
+/* search sequences in FILE_LIST[srcN] for STRING with up to MAX_EDITS edits */
+int fproc_search_approx(const size_t srcN, const char *string, const size_t max_edits)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: source buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	static struct search_out out;
+	struct approx_search search;
+
+	if (approx_init(&search, string, strlen(string), max_edits, &out) == -1) {
+		return -1;
+	}
+
+	search_out_init(&out, stdout);
+	long status = search_tree(file_list[srcN], &search, sizeof(search), &search_approx,
+				  default_thread_count());
+	search_out_flush(&out);
+
+	if (status == -1) {
+		fprintf(stderr, "error: searching buffer %lu failed\n", srcN + 1);
+		approx_free(&search);
+		return -1;
+	}
+
+	fprintf(stdout, "%ld matches in %ld sequences\n", search.result.nmatches, search.result.nrecords);
+
+	approx_free(&search);
+	return search.result.nrecords;
+}
+
+/* search sequences in FILE_LIST[srcN] for every pattern in PATTERNFILE at once */
+int fproc_search_multi(const size_t srcN, const char *patternfile)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: source buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	struct pattern_set *patterns = load_patterns(patternfile);
+	if (patterns == NULL) {
+		fprintf(stderr, "error: unable to load patterns from %s\n", patternfile);
+		return -1;
+	}
+
+	static struct search_out out;
+	struct multi_search search = {
+		.patterns = patterns,
+		.result.out = &out,
+	};
+
+	search_out_init(&out, stdout);
+	long status = search_tree(file_list[srcN], &search, sizeof(search), &search_patterns,
+				  default_thread_count());
+	search_out_flush(&out);
+
+	if (status == -1) {
+		fprintf(stderr, "error: searching buffer %lu failed\n", srcN + 1);
+		free_patterns(patterns);
+		return -1;
+	}
+
+	fprintf(stdout, "%ld matches of %lu patterns in %ld sequences\n",
+		search.result.nmatches, patterns->npatterns, search.result.nrecords);
+
+	free_patterns(patterns);
+	return search.result.nrecords;
+}
+
+/* print the memory budget, what is held within it and how the sequence cache is doing */
+void fproc_memory(void)
+{
+	struct seq_cache_stats stats;
+	const double mib = 1024.0 * 1024.0;
+
+	seq_cache_stats(&stats);
+	if (memory_budget == 0) {
+		fprintf(stdout, "no memory budget: %.1f MiB held by buffers\n", resident_bytes() / mib);
+		return;
+	}
+
+	fprintf(stdout, "memory budget %.1f MiB: %.1f MiB held by buffers, "
+		"%.1f MiB of %.1f MiB cache used by %lu sequences\n",
+		memory_budget / mib, resident_bytes() / mib, stats.used / mib, stats.limit / mib,
+		stats.entries);
+	fprintf(stdout, "cache: %lu hits, %lu misses, %lu evictions\n",
+		stats.hits, stats.misses, stats.evictions);
+}
+
+/* limit memory held by buffers to BUDGET bytes, or lift the limit if 0 */
+int fproc_budget(const size_t budget)
+{
+	memory_budget = budget;
+	update_cache_limit();
+	fproc_memory();
+	return 0;
 }
 
 /* delete contents of FILE_LIST[srcN] */
@@ -209,6 +854,7 @@ int fproc_delete(const size_t srcN)
 	else {
 		free_gene_tree(file_list[srcN]);
 		file_list[srcN] = NULL;
+		update_cache_limit();
 	}
 	return 0;
 }
@@ -222,37 +868,188 @@ void fproc_delete_all(void)
 			file_list[i] = NULL;
 		}
 	}
+	update_cache_limit();
 }
 
 /* Static function declarations */
 
-static int defsearch(const char *defline, const char *sequence, const char *string)
+static size_t tree_bytes(const struct gene_tree *tree)
 {
-	char *match;
-	if ((match = strstr(defline, string)) != NULL) {
-		fputs("Match found:\n", stdout);
-		
-		for (const char *tmp = defline; tmp != match; ++tmp) {
-			fputc(*tmp, stdout);
+	/* nodes and deflines, then packed sequences and any copied out of their files */
+	size_t total = tree->arena.total + tree->seq_arena.total;
+
+	for (const struct gene_map *map = tree->maps; map != NULL; map = map->next) {
+		total += (map->fd == -1) ? map->len : 0;
+	}
+	return total;
+}
+
+static size_t resident_bytes(void)
+{
+	size_t total = 0;
+
+	for (size_t i = 0; i < FILE_MAX; i++) {
+		total += (file_list[i] != NULL) ? tree_bytes(file_list[i]) : 0;
+	}
+	return total;
+}
+
+static void update_cache_limit(void)
+{
+	int tried[FILE_MAX] = { 0 };
+	size_t resident;
+
+	while (memory_budget > 0 && (resident = resident_bytes()) > memory_budget) {
+		size_t largest = FILE_MAX;
+
+		for (size_t i = 0; i < FILE_MAX; i++) {
+			if (file_list[i] != NULL && !tried[i] &&
+			    (largest == FILE_MAX || tree_bytes(file_list[i]) > tree_bytes(file_list[largest]))) {
+				largest = i;
+			}
+		}
+		if (largest == FILE_MAX) {
+			fputs("warning: buffers are over the memory budget, and none left can be read lazily\n",
+			      stdout);
+			break;
+		}
+
+		tried[largest] = 1;
+		int status = evict_tree(file_list[largest]);
+
+		if (status == 1) {
+			fprintf(stdout, "buffer %lu is over the memory budget: reading its sequences lazily\n",
+				largest + 1);
+		}
+		else if (status == -1) {
+			fprintf(stderr, "error: failed to drop the sequences of buffer %lu\n", largest + 1);
 		}
-		fprintf(stdout, "\033[0;31m%s\033[0m%s\n", string, match + strlen(string));
-		return 1;
 	}
-	else 
-		return 0;
+
+	resident = resident_bytes();
+	seq_cache_set_limit((memory_budget > resident) ? memory_budget - resident : 0);
 }
-static int seqsearch(const char *defline, const char *sequence, const char *string)
+
+static int over_budget(const char *infile)
 {
-	char *match;
-	if ((match = strstr(sequence, string)) != NULL) {
-		fputs("Match found:\n", stdout);
+	struct stat st;
+	char magic[32];
+	FILE *stream;
 
-		for (const char *tmp = sequence; tmp != match; ++tmp) {
-			fputc(*tmp, stdout);
+	if (memory_budget == 0 || stat(infile, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    resident_bytes() + (size_t) st.st_size <= memory_budget) {
+		return 0;
+	}
+
+	/* compressed files have no offsets to read sequences back from */
+	if ((stream = fopen(infile, "rb")) != NULL) {
+		size_t len = fread(magic, 1, sizeof(magic), stream);
+
+		fclose(stream);
+		if (bgzf_is_gzip(magic, len)) {
+			fprintf(stdout, "warning: %s is compressed, so is read in full "
+				"despite the memory budget\n", infile);
+			return 0;
 		}
-		fprintf(stdout, "\033[0;31m%s\033[0m%s\n", string, match + strlen(string));
-		return 1;
 	}
-	else
+	return 1;
+}
+
+static int extract_region(struct gene_tree *tree, const struct region *region)
+{
+	if (tree->index == NULL && (tree->index = index_build(tree, INDEX_ACCESSION)) == NULL) {
+		fprintf(stderr, "error: failed to index %s\n", tree->filename);
 		return 0;
+	}
+
+	size_t cursor = 0;
+	struct gene_node *node;
+	int found = 0;
+	int count = 0;
+
+	while ((node = index_find(tree->index, region->id, region->id_len, &cursor)) != NULL) {
+		count += (region_print(region, node, stdout) == 0);
+		++found;
+	}
+	if (!found) {
+		fprintf(stdout, "%.*s: not found\n", (int) region->id_len, region->id);
+	}
+	return count;
+}
+
+static int run_search(const size_t srcN, const char *string,
+		      int (*search_fn)(const struct gene_node *, void *), const int use_kmers)
+{
+	if (srcN >= FILE_MAX) {
+		fprintf(stderr, "error: source buffer number %lu is out of bounds\n", srcN + 1);
+		return -1;
+	}
+	else if (file_list[srcN] == NULL) {
+		fprintf(stdout, "buffer %lu is empty: nothing to do\n", srcN + 1);
+		return 0;
+	}
+
+	static struct search_out out;
+	struct substring_search search = {
+		.pattern = string,
+		.pattern_len = strlen(string),
+		.result.out = &out,
+	};
+
+	const struct kmer_index *kmers = use_kmers ? file_list[srcN]->kmers : NULL;
+	int indexed = 0;
+
+	search_out_init(&out, stdout);
+	if (kmers != NULL && kmer_index_usable(kmers, search.pattern, search.pattern_len)) {
+		indexed = 1;
+		if (kmer_index_search(kmers, &search) == -1) {
+			search_out_flush(&out);
+			return -1;
+		}
+	}
+	else if (search_tree(file_list[srcN], &search, sizeof(search), search_fn,
+			     default_thread_count()) == -1) {
+		search_out_flush(&out);
+		fprintf(stderr, "error: searching buffer %lu failed\n", srcN + 1);
+		return -1;
+	}
+	search_out_flush(&out);
+
+	fprintf(stdout, "%ld matches in %ld sequences%s\n", search.result.nmatches, search.result.nrecords,
+		indexed ? " (k-mer index)" : "");
+	return search.result.nrecords;
+}
+
+static int write_records(const struct gene_tree *tree, const int fd, const size_t wrap,
+			 const int direct, const size_t bgzf_threads)
+{
+	struct record_writer writer;
+
+	if (writer_init(&writer, fd, wrap, direct, bgzf_threads) == -1) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	int status = print_tree_full(tree, &writer);
+	int saved = errno;
+
+	/* finish regardless, to release the buffer */
+	if (writer_finish(&writer) == -1) {
+		return -1;
+	}
+	if (status == -1) {
+		errno = saved;
+	}
+	return status;
+}
+
+static int fm_hit_cmp(const void *a, const void *b)
+{
+	const struct fm_hit *x = a;
+	const struct fm_hit *y = b;
+
+	if (x->record != y->record) {
+		return (x->record > y->record) - (x->record < y->record);
+	}
+	return (x->offset > y->offset) - (x->offset < y->offset);
 }
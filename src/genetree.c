@@ -1,21 +1,160 @@
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <pthread.h>
+#include <unistd.h>
+
 #include <genetree.h>
+#include <dsw.h>
+#include <hashindex.h>
+#include <fmindex.h>
+#include <kmerindex.h>
+#include <packseq.h>
+#include <parse.h>
+#include <seqcache.h>
+
+/* per-thread buffer returned by gene_node_sequence() for packed and lazy nodes */
+struct seq_buf {
+	char *data;
+	size_t capacity;
+};
 
-static void free_gene_node (struct gene_node *gene_node);
+static pthread_key_t seq_buf_key;
+static pthread_once_t seq_buf_once = PTHREAD_ONCE_INIT;
 
-static struct gene_node *init_gene_node (const char *defline, size_t defline_len, const char *sequence, size_t sequence_len);
+static void init_seq_buf_key (void);
+static char *reserve_seq_buf (size_t len);
+static void free_seq_buf (void *buf);
+
+static struct gene_node *init_gene_node (struct gene_tree *tree, const struct gene_node *contents);
+static void drop_sequence_indexes (struct gene_tree *tree);
+static const char *read_lazy (const struct lazy_seq *lazy, size_t from, size_t count);
 
 /* Define an ordering for gene sequences g1 and g2. */
 int genecmp (const struct gene_node *g1, const struct gene_node *g2)
 {
-	/* Crudest possible ordering - alphabetical comparison of deflines */
-	return strcmp(g1->defline, g2->defline);
+	if (g1->key != g2->key) {
+		return (g1->key > g2->key) - (g1->key < g2->key);
+	}
+	return genecmp_key(g1, g2->defline, g2->defline_len);
 }	
 
+/* Compare NODE's defline with the LEN bytes at KEY, in genecmp() order. */
+int genecmp_key (const struct gene_node *node, const char *key, size_t len)
+{
+	uint64_t prefix = gene_key_prefix(key, len);
+
+	if (node->key != prefix) {
+		return (node->key > prefix) - (prefix > node->key);
+	}
+
+	/* Crudest possible ordering - alphabetical comparison of deflines.
+	   Deflines are not null-terminated, so a defline sorts before any
+	   longer defline it is a prefix of, as it would under strcmp().
+	   Equal keys mean the first bytes already match. */
+	size_t min_len = (node->defline_len < len) ? node->defline_len : len;
+	size_t skip = (min_len < GENE_KEY_LEN) ? min_len : GENE_KEY_LEN;
+	int cmp = memcmp(node->defline + skip, key + skip, min_len - skip);
+
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (node->defline_len > len) - (node->defline_len < len);
+}
+
+uint64_t gene_key_prefix (const char *key, size_t len)
+{
+	uint8_t bytes[GENE_KEY_LEN] = {0};
+	uint64_t prefix = 0;
+
+	memcpy(bytes, key, (len < GENE_KEY_LEN) ? len : GENE_KEY_LEN);
+	for (size_t i = 0; i < GENE_KEY_LEN; i++) {
+		prefix = (prefix << 8) | bytes[i];
+	}
+	return prefix;
+}
+
+const char *gene_node_sequence (const struct gene_node *node)
+{
+	return gene_node_window(node, 0, node->sequence_len);
+}
+
+const char *gene_node_window (const struct gene_node *node, size_t from, size_t count)
+{
+	if (node->lazy != NULL) {
+		/* only whole sequences are worth reading into the cache */
+		int whole = (from == 0 && count == node->sequence_len);
+		const char *cached = seq_cache_get(node->lazy, node->sequence_len, whole);
+		return (cached != NULL) ? cached + from : read_lazy(node->lazy, from, count);
+	}
+	else if (node->packed == NULL) {
+		return node->sequence + from;
+	}
+
+	char *buf = reserve_seq_buf(count);
+	if (buf != NULL) {
+		unpack_sequence(node->packed, from, count, buf);
+	}
+	return buf;
+}
+
+size_t lazy_seq_span (const struct lazy_seq *lazy, size_t from, size_t count)
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	/* the bytes from base FROM up to and including base FROM + COUNT - 1 */
+	uint64_t bases = lazy->line_bases;
+	uint64_t last = from + count - 1;
+
+	return (last / bases - from / bases) * lazy->line_width + last % bases + 1 - from % bases;
+}
+
+int lazy_seq_read (const struct lazy_seq *lazy, size_t from, size_t count, char *buf)
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	uint64_t bases = lazy->line_bases;
+	uint64_t begin = lazy->offset + from / bases * lazy->line_width + from % bases;
+	size_t len = lazy_seq_span(lazy, from, count);
+
+	for (size_t done = 0; done < len; ) {
+		ssize_t nread = pread(lazy->fd, buf + done, len - done, begin + done);
+
+		if (nread == -1 && errno == EINTR) {
+			continue;
+		}
+		else if (nread <= 0) {
+			/* the file has changed or gone */
+			return -1;
+		}
+		done += nread;
+	}
+
+	/* close up the line ends; bases only ever move towards the start */
+	if (lazy->line_width != lazy->line_bases) {
+		size_t first = bases - from % bases; /* bases left on the first line */
+		char *dest = buf + ((first < count) ? first : count);
+		const char *src = buf + first + (lazy->line_width - bases);
+
+		for (size_t left = count - (dest - buf); left > 0; ) {
+			size_t n = (left < bases) ? left : bases;
+
+			memmove(dest, src, n);
+			dest += n;
+			src += lazy->line_width;
+			left -= n;
+		}
+	}
+	return 0;
+}
+
 /* Given filename, and length (excluding null character), initialise and return gene_tree structure.
    Return NULL pointer on failure. */
 struct gene_tree *init_gene_tree (const char *filename, size_t file_len)
@@ -26,6 +165,12 @@ struct gene_tree *init_gene_tree (const char *filename, size_t file_len)
 		tree->filename = malloc((file_len + 1));
 		tree->size = 0;
 		tree->root = NULL;
+		tree->maps = NULL;
+		tree->index = NULL;
+		tree->kmers = NULL;
+		tree->fm = NULL;
+		arena_init(&tree->arena);
+		arena_init(&tree->seq_arena);
 	}
 
 	/*  NOTE: Can strcpy actually fail and return NULL? */
@@ -40,7 +185,17 @@ struct gene_tree *init_gene_tree (const char *filename, size_t file_len)
 void free_gene_tree (struct gene_tree *tree)
 {
 	if (tree != NULL) {
-		free_gene_node(tree->root);
+		/* nodes all live in the arena - no need to walk the tree */
+		tree->root = NULL;
+		index_free(tree->index);
+		tree->index = NULL;
+		drop_sequence_indexes(tree);
+		/* maps first: closing a lazily read file drops its cached
+		   sequences, which refer to locations in the arena */
+		unmap_file_list(tree->maps);
+		tree->maps = NULL;
+		arena_free(&tree->arena);
+		arena_free(&tree->seq_arena);
 		free(tree->filename);
 		tree->filename = NULL;
 	}
@@ -48,7 +203,8 @@ void free_gene_tree (struct gene_tree *tree)
 	tree=NULL;
 }
 
-/* Add new node to gene_tree, if not already present.
+/* Add new node to gene_tree, if not already present. DEFLINE is copied,
+   but SEQUENCE is referenced and must live as long as the tree does.
    Return 0 on success, -1 on failure. */
 int gene_tree_insert (struct gene_tree *tree,
 		      const char *defline, size_t defline_len, const char *sequence, size_t sequence_len)
@@ -56,14 +212,21 @@ int gene_tree_insert (struct gene_tree *tree,
 	if (defline == NULL || sequence == NULL) {
 		return -1;
 	}
-	struct gene_node *new_node = init_gene_node(defline, defline_len, sequence, sequence_len);
 
-	if (new_node == NULL) {
-		return -1;
-	}
-	else if (tree->root == NULL) {
-		tree->root = new_node;
+	struct gene_node key = {
+		.key = gene_key_prefix(defline, defline_len),
+		.defline = defline,
+		.sequence = sequence,
+		.defline_len = defline_len,
+		.sequence_len = sequence_len,
+	};
+
+	if (tree->root == NULL) {
+		if ((tree->root = init_gene_node(tree, &key)) == NULL) {
+			return -1;
+		}
 
+		drop_sequence_indexes(tree);
 		++(tree->size);
 		return 0;
 	}
@@ -75,7 +238,7 @@ int gene_tree_insert (struct gene_tree *tree,
 
 	do { /* while (curr_node != NULL) */
 		
-		nodecmp = genecmp(new_node, curr_node);
+		nodecmp = genecmp(&key, curr_node);
 		if (nodecmp < 0) {
 			prev_node = curr_node;
 			curr_node = curr_node->left;
@@ -86,61 +249,186 @@ int gene_tree_insert (struct gene_tree *tree,
 		}
 		else {
 			/* already in tree */
-			free_gene_node(new_node);
 			return 0;
 		}
 	} while (curr_node != NULL);
 
-	if (nodecmp < 0) {
+	/* only allocate once we know the node is new */
+	struct gene_node *new_node = init_gene_node(tree, &key);
+
+	if (new_node == NULL) {
+		return -1;
+	}
+	else if (nodecmp < 0) {
 		prev_node->left = new_node;
 	}
 	else {
 		prev_node->right = new_node;
 	}
 
+	drop_sequence_indexes(tree);
 	++(tree->size);
 	return 0;
 }
 
+/* Hand the arenas and maps of SRC_TREE over to DEST_TREE, so nodes moved
+   from one to the other keep their storage alive. */
+void gene_tree_adopt (struct gene_tree *dest_tree, struct gene_tree *src_tree)
+{
+	/* DEST_TREE is about to gain nodes */
+	drop_sequence_indexes(dest_tree);
+	drop_sequence_indexes(src_tree);
+
+	arena_adopt(&dest_tree->arena, &src_tree->arena);
+	arena_adopt(&dest_tree->seq_arena, &src_tree->seq_arena);
+
+	if (src_tree->maps != NULL) {
+		struct gene_map *last = src_tree->maps;
+		while (last->next != NULL) {
+			last = last->next;
+		}
+		last->next = dest_tree->maps;
+		dest_tree->maps = src_tree->maps;
+		src_tree->maps = NULL;
+	}
+}
+
+/* Fill empty TREE from the N records in RECS, which must be sorted by
+   defline with no duplicates, as a perfectly balanced tree. Deflines are
+   copied; sequences are referenced, as by gene_tree_insert().
+   Return 0 on success, -1 on failure. */
+int gene_tree_build (struct gene_tree *tree, struct gene_record *const *recs, size_t n)
+{
+	if (tree->root != NULL) {
+		return -1;
+	}
+	else if (n == 0) {
+		return 0;
+	}
+
+	size_t deflines_len = 0;
+	for (size_t i = 0; i < n; i++) {
+		deflines_len += recs[i]->defline_len;
+	}
+
+	/* one allocation for every node, laid out in sorted order, and one
+	   for their deflines, back to back in the same order */
+	struct gene_node *nodes = arena_alloc(&tree->arena, n * sizeof(*nodes));
+	char *deflines = arena_alloc(&tree->arena, deflines_len);
+	struct gene_node **order = malloc(n * sizeof(*order));
+
+	if (nodes == NULL || deflines == NULL || order == NULL) {
+		free(order);
+		return -1;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		struct gene_node *node = &nodes[i];
+
+		memcpy(deflines, recs[i]->defline, recs[i]->defline_len);
+		node->key = gene_key_prefix(deflines, recs[i]->defline_len);
+		node->defline = deflines;
+		deflines += recs[i]->defline_len;
+
+		node->sequence = recs[i]->sequence;
+		node->defline_len = recs[i]->defline_len;
+		node->sequence_len = recs[i]->sequence_len;
+		node->packed = NULL;
+		node->lazy = recs[i]->lazy;
+
+		order[i] = node;
+	}
+
+	drop_sequence_indexes(tree);
+	tree->root = build_balanced_tree(order, n);
+	tree->size = n;
+
+	free(order);
+	return 0;
+}
+
 /*
  * STATIC FUNCTION DEFINITIONS
  */
 
-static struct gene_node *init_gene_node (const char *defline, size_t defline_len, const char *sequence, size_t sequence_len)
+/* Allocate a node holding CONTENTS, with its own copy of the defline.
+   Return NULL on failure. */
+static struct gene_node *init_gene_node (struct gene_tree *tree, const struct gene_node *contents)
+{
+	struct gene_node *node = arena_alloc(&tree->arena, sizeof(*node));
+	char *defline = arena_memdup(&tree->arena, contents->defline, contents->defline_len);
+
+	if (node == NULL || defline == NULL) {
+		return NULL;
+	}
+
+	*node = *contents;
+	node->defline = defline;
+	node->right = NULL;
+	node->left = NULL;
+	return node;
+}
+
+/* sequence indexes refer to nodes by rank, so any insertion invalidates them */
+static void drop_sequence_indexes (struct gene_tree *tree)
+{
+	kmer_index_free(tree->kmers);
+	tree->kmers = NULL;
+	fm_index_free(tree->fm);
+	tree->fm = NULL;
+}
+
+/* Read COUNT bases from FROM of the sequence at LAZY into this thread's
+   buffer. Return the bases, or NULL on failure. */
+static const char *read_lazy (const struct lazy_seq *lazy, size_t from, size_t count)
 {
-	struct gene_node *node = malloc(sizeof(*node));
-	if (node != NULL) {
-		node->defline = malloc(defline_len + 1);
-		node->sequence = malloc(sequence_len + 1);
+	char *buf = reserve_seq_buf(lazy_seq_span(lazy, from, count));
 
-		node->right = NULL;
-		node->left = NULL;
+	if (buf == NULL || lazy_seq_read(lazy, from, count, buf) == -1) {
+		return NULL;
 	}
+	return buf;
+}
 
+/* this thread's sequence buffer, grown to at least LEN bytes */
+static char *reserve_seq_buf (size_t len)
+{
+	pthread_once(&seq_buf_once, &init_seq_buf_key);
 
-	/* NOTE: Can strcpy actually fail and return NULL? */
-	if ((node->defline == NULL) || (strcpy(node->defline, defline) == NULL)) {
-		free_gene_node(node);
+	struct seq_buf *buf = pthread_getspecific(seq_buf_key);
+
+	if (buf == NULL) {
+		if ((buf = calloc(1, sizeof(*buf))) == NULL) {
+			return NULL;
+		}
+		pthread_setspecific(seq_buf_key, buf);
 	}
-	if ((node->sequence == NULL) || (strcpy(node->sequence, sequence) == NULL)) {
-		free_gene_node(node);
+
+	if (buf->capacity < len || buf->data == NULL) {
+		size_t capacity = len ? len : 1;
+
+		/* need a temporary buffer, since realloc leaves BUF unchanged on failure */
+		char *tmp = realloc(buf->data, capacity);
+		if (tmp == NULL) {
+			return NULL;
+		}
+		buf->data = tmp;
+		buf->capacity = capacity;
 	}
+	return buf->data;
+}
 
-	return node;
+static void init_seq_buf_key (void)
+{
+	pthread_key_create(&seq_buf_key, &free_seq_buf);
 }
 
-static void free_gene_node (struct gene_node *node)
+static void free_seq_buf (void *ptr)
 {
-	if (node != NULL) {
-		free(node->defline);
-		free(node->sequence);
-		node->defline = NULL;
-		node->sequence = NULL;
-		
-		/* free children recursively */
-		free_gene_node(node->right);
-		free_gene_node(node->left);
+	struct seq_buf *buf = ptr;
+
+	if (buf != NULL) {
+		free(buf->data);
 	}
-	free(node);
-	node = NULL;
+	free(buf);
 }
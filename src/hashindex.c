@@ -0,0 +1,195 @@
+/* hashindex.c - exact-match hash index over a gene_tree */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <genetree.h>
+#include <hashindex.h>
+#include <treeops.h>
+
+#define CAPACITY_MIN 64
+
+static size_t key_length (enum index_key key, const struct gene_node *node);
+static uint64_t hash_bytes (const char *key, size_t len);
+static int index_grow (struct gene_index *index);
+static void index_place (struct gene_index *index, struct gene_node *node);
+static int index_nodes (struct gene_index *index, const struct gene_tree *tree);
+
+struct gene_index *index_build (const struct gene_tree *tree, enum index_key key)
+{
+	struct gene_index *index = malloc(sizeof(*index));
+
+	if (index == NULL) {
+		return NULL;
+	}
+
+	/* room for every node at a load factor of at most one half */
+	size_t capacity = CAPACITY_MIN;
+	while (capacity < 2 * tree->size) {
+		capacity *= 2;
+	}
+
+	index->key = key;
+	index->size = 0;
+	index->capacity = capacity;
+	index->slots = calloc(capacity, sizeof(*index->slots));
+
+	if (index->slots == NULL) {
+		free(index);
+		return NULL;
+	}
+
+	if (index_nodes(index, tree) == -1) {
+		index_free(index);
+		return NULL;
+	}
+	return index;
+}
+
+int index_insert (struct gene_index *index, struct gene_node *node)
+{
+	/* keep the load factor under 3/4 */
+	if (4 * (index->size + 1) > 3 * index->capacity && index_grow(index) == -1) {
+		return -1;
+	}
+
+	index_place(index, node);
+	return 0;
+}
+
+struct gene_node *index_find (const struct gene_index *index, const char *key, size_t len,
+			      size_t *cursor)
+{
+	size_t mask = index->capacity - 1;
+	size_t slot = (hash_bytes(key, len) + *cursor) & mask;
+
+	/* linear probing: every node under KEY lies before the next empty slot */
+	for (; *cursor < index->capacity; slot = (slot + 1) & mask) {
+		struct gene_node *node = index->slots[slot];
+
+		++(*cursor);
+		if (node == NULL) {
+			*cursor = index->capacity;
+			return NULL;
+		}
+		else if (key_length(index->key, node) == len && memcmp(node->defline, key, len) == 0) {
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+void index_free (struct gene_index *index)
+{
+	if (index != NULL) {
+		free(index->slots);
+		index->slots = NULL;
+	}
+	free(index);
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* length of the prefix of NODE's defline it is indexed under */
+static size_t key_length (enum index_key key, const struct gene_node *node)
+{
+	if (key == INDEX_DEFLINE) {
+		return node->defline_len;
+	}
+
+	size_t len = 0;
+	while (len < node->defline_len && node->defline[len] != ' ' && node->defline[len] != '\t') {
+		++len;
+	}
+	return len;
+}
+
+/* 64-bit multiplicative hash, eight bytes at a time */
+static uint64_t hash_bytes (const char *key, size_t len)
+{
+	const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+	uint64_t hash = len * mul;
+
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, key, 8);
+
+		hash = (hash ^ word) * mul;
+		hash ^= hash >> 29;
+
+		key += 8;
+		len -= 8;
+	}
+
+	if (len > 0) {
+		uint64_t word = 0;
+		memcpy(&word, key, len);
+
+		hash = (hash ^ word) * mul;
+		hash ^= hash >> 29;
+	}
+
+	hash *= mul;
+	return hash ^ (hash >> 32);
+}
+
+static int index_grow (struct gene_index *index)
+{
+	struct gene_node **old_slots = index->slots;
+	size_t old_capacity = index->capacity;
+
+	struct gene_node **slots = calloc(2 * old_capacity, sizeof(*slots));
+	if (slots == NULL) {
+		return -1;
+	}
+
+	index->slots = slots;
+	index->capacity = 2 * old_capacity;
+	index->size = 0;
+
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old_slots[i] != NULL) {
+			index_place(index, old_slots[i]);
+		}
+	}
+
+	free(old_slots);
+	return 0;
+}
+
+/* put NODE in the first free slot at or after its hash. INDEX must not be full */
+static void index_place (struct gene_index *index, struct gene_node *node)
+{
+	size_t mask = index->capacity - 1;
+	size_t slot = hash_bytes(node->defline, key_length(index->key, node)) & mask;
+
+	while (index->slots[slot] != NULL) {
+		slot = (slot + 1) & mask;
+	}
+
+	index->slots[slot] = node;
+	++(index->size);
+}
+
+static int index_nodes (struct gene_index *index, const struct gene_tree *tree)
+{
+	struct tree_cursor cursor;
+	struct gene_node *node;
+
+	if (cursor_init_preorder(&cursor, tree) == -1) {
+		cursor_free(&cursor);
+		return -1;
+	}
+
+	/* the table was sized for the whole tree up front */
+	while ((node = cursor_next(&cursor)) != NULL) {
+		index_place(index, node);
+	}
+
+	cursor_free(&cursor);
+	return 0;
+}
@@ -0,0 +1,489 @@
+/* kmerindex.c - k-mer posting index over the sequences of a gene_tree */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include <genetree.h>
+#include <kmerindex.h>
+#include <mapfile.h>
+#include <search.h>
+#include <treeops.h>
+
+/* hashed indexes get at most 2^BITS_MAX buckets */
+#define BITS_MAX 26
+
+#define KMER_MAGIC "FPKMER1"
+
+#define FNV_PRIME 0x100000001b3ULL
+
+/* base_code[c] : 1-4 for ACGT, 0 for anything else, which breaks a k-mer */
+static const uint8_t base_code[256] = {
+	['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+	['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4,
+};
+
+/* on-disk layout: this header, then STARTS (nbuckets + 1 entries), then HITS */
+struct kmer_file_header {
+	char magic[8];
+	uint32_t k;
+	uint32_t bits;
+	uint64_t nrecords;
+	uint64_t checksum;
+	uint64_t nhits;
+	uint64_t reserved[3];
+};
+
+static struct kmer_index *new_index (const struct gene_tree *tree, unsigned k);
+static uint64_t hash_bytes (uint64_t hash, const char *bytes, size_t len);
+static uint64_t kmer_bucket (const struct kmer_index *index, uint64_t code);
+static long scan_kmers (struct kmer_index *index, uint64_t *starts, struct kmer_hit *hits);
+static int find_hit (const struct kmer_index *index, uint64_t bucket, uint32_t record, uint32_t offset);
+static int starts_valid (const uint64_t *starts, size_t nbuckets, uint64_t nhits);
+
+struct kmer_index *kmer_index_build (const struct gene_tree *tree, unsigned k)
+{
+	if (k < KMER_MIN || k > KMER_MAX) {
+		fprintf(stderr, "error: k-mer length must be between %d and %d\n", KMER_MIN, KMER_MAX);
+		return NULL;
+	}
+
+	struct kmer_index *index = new_index(tree, k);
+	if (index == NULL) {
+		return NULL;
+	}
+
+	/* about one bucket per indexed base, unless 4^K is fewer */
+	size_t total = 0;
+	for (size_t r = 0; r < index->nrecords; r++) {
+		if (index->records[r]->sequence_len > UINT32_MAX) {
+			fputs("error: sequence too long for k-mer index\n", stderr);
+			kmer_index_free(index);
+			return NULL;
+		}
+		total += index->records[r]->sequence_len;
+	}
+
+	index->bits = 1;
+	while (((size_t) 1 << index->bits) < total && index->bits < BITS_MAX) {
+		++(index->bits);
+	}
+	if (index->bits > 2 * k) {
+		index->bits = 2 * k;
+	}
+
+	/* Counting sort. The first pass counts into STARTS[b + 2], so after the
+	   prefix sum STARTS[b + 1] is where bucket b begins; the second pass
+	   fills using STARTS[b + 1]++, which leaves STARTS[b] where bucket b begins. */
+	size_t nbuckets = (size_t) 1 << index->bits;
+	uint64_t *starts = calloc(nbuckets + 2, sizeof(*starts));
+
+	if (starts == NULL || scan_kmers(index, starts, NULL) == -1) {
+		free(starts);
+		kmer_index_free(index);
+		return NULL;
+	}
+
+	for (size_t b = 1; b < nbuckets + 2; b++) {
+		starts[b] += starts[b - 1];
+	}
+	index->nhits = starts[nbuckets + 1];
+
+	struct kmer_hit *hits = malloc((index->nhits ? index->nhits : 1) * sizeof(*hits));
+
+	if (hits == NULL || scan_kmers(index, starts, hits) == -1) {
+		free(hits);
+		free(starts);
+		kmer_index_free(index);
+		return NULL;
+	}
+
+	index->starts = starts;
+	index->hits = hits;
+	return index;
+}
+
+int kmer_index_save (const struct kmer_index *index, const char *filename)
+{
+	struct kmer_file_header header;
+	size_t nbuckets = (size_t) 1 << index->bits;
+	FILE *stream = fopen(filename, "wb");
+
+	if (stream == NULL) {
+		fprintf(stderr, "unable to open file %s\n", filename);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KMER_MAGIC, sizeof(header.magic));
+	header.k = index->k;
+	header.bits = index->bits;
+	header.nrecords = index->nrecords;
+	header.checksum = index->checksum;
+	header.nhits = index->nhits;
+
+	int status = 0;
+	if (fwrite(&header, sizeof(header), 1, stream) != 1 ||
+	    fwrite(index->starts, sizeof(*index->starts), nbuckets + 1, stream) != nbuckets + 1 ||
+	    fwrite(index->hits, sizeof(*index->hits), index->nhits, stream) != index->nhits) {
+		status = -1;
+	}
+
+	if (fclose(stream) != 0 || status == -1) {
+		fprintf(stderr, "unable to write file %s\n", filename);
+		return -1;
+	}
+	return 0;
+}
+
+struct kmer_index *kmer_index_load (const struct gene_tree *tree, const char *filename)
+{
+	struct kmer_file_header header;
+	struct gene_map *map = map_file(filename);
+
+	if (map == NULL) {
+		return NULL;
+	}
+	else if (map->len < sizeof(header)) {
+		fprintf(stderr, "%s is not a k-mer index\n", filename);
+		unmap_file(map);
+		return NULL;
+	}
+
+	memcpy(&header, map->addr, sizeof(header));
+
+	size_t nbuckets = (header.bits <= BITS_MAX) ? (size_t) 1 << header.bits : 0;
+
+	if (memcmp(header.magic, KMER_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.k < KMER_MIN || header.k > KMER_MAX ||
+	    header.bits > 2 * header.k || header.bits > BITS_MAX ||
+	    header.nhits > map->len / sizeof(struct kmer_hit) ||
+	    map->len != sizeof(header) + (nbuckets + 1) * sizeof(uint64_t)
+	    + header.nhits * sizeof(struct kmer_hit) ||
+	    !starts_valid((const uint64_t *) (map->addr + sizeof(header)), nbuckets, header.nhits)) {
+
+		fprintf(stderr, "%s is not a k-mer index\n", filename);
+		unmap_file(map);
+		return NULL;
+	}
+
+	struct kmer_index *index = new_index(tree, header.k);
+	if (index == NULL) {
+		unmap_file(map);
+		return NULL;
+	}
+
+	if (index->nrecords != header.nrecords || index->checksum != header.checksum) {
+		fprintf(stderr, "%s was saved for different sequences\n", filename);
+		unmap_file(map);
+		kmer_index_free(index);
+		return NULL;
+	}
+
+	/* lookups touch a few buckets each, anywhere in the file */
+	if (map->mapped) {
+		madvise(map->addr, map->len, MADV_RANDOM);
+	}
+
+	index->bits = header.bits;
+	index->nhits = header.nhits;
+	index->starts = (const uint64_t *) (map->addr + sizeof(header));
+	index->hits = (const struct kmer_hit *) (index->starts + nbuckets + 1);
+	index->map = map;
+	return index;
+}
+
+int kmer_index_usable (const struct kmer_index *index, const char *pattern, size_t len)
+{
+	size_t valid = 0;
+
+	for (size_t i = 0; i < len && valid < index->k; i++) {
+		valid = (base_code[(unsigned char) pattern[i]] != 0) ? valid + 1 : 0;
+	}
+	return valid == index->k;
+}
+
+long kmer_index_search (const struct kmer_index *index, struct substring_search *search)
+{
+	const char *pattern = search->pattern;
+	const size_t len = search->pattern_len;
+	const uint64_t mask = (index->k == 32) ? ~(uint64_t) 0 : ((uint64_t) 1 << (2 * index->k)) - 1;
+
+	if (len < index->k) {
+		return -1;
+	}
+
+	/* the two least common k-mers of the pattern: candidates come from the
+	   first, and must also appear at the right place in the second */
+	size_t anchor = 0, other = 0;
+	uint64_t anchor_bucket = 0, other_bucket = 0;
+	uint64_t anchor_count = UINT64_MAX, other_count = UINT64_MAX;
+	uint64_t code = 0;
+	size_t valid = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		uint8_t base = base_code[(unsigned char) pattern[i]];
+
+		if (base == 0) {
+			code = 0;
+			valid = 0;
+			continue;
+		}
+
+		code = ((code << 2) | (base - 1)) & mask;
+		if (++valid < index->k) {
+			continue;
+		}
+
+		size_t at = i + 1 - index->k;
+		uint64_t bucket = kmer_bucket(index, code);
+		uint64_t count = index->starts[bucket + 1] - index->starts[bucket];
+
+		if (count < anchor_count) {
+			other = anchor;
+			other_bucket = anchor_bucket;
+			other_count = anchor_count;
+
+			anchor = at;
+			anchor_bucket = bucket;
+			anchor_count = count;
+		}
+		else if (count < other_count) {
+			other = at;
+			other_bucket = bucket;
+			other_count = count;
+		}
+	}
+
+	if (anchor_count == UINT64_MAX) {
+		/* no window of the pattern is plain ACGT */
+		return -1;
+	}
+
+	long nrecords = 0;
+	uint32_t last_record = UINT32_MAX;
+
+	for (uint64_t h = index->starts[anchor_bucket]; h < index->starts[anchor_bucket + 1]; h++) {
+		const struct kmer_hit *hit = &index->hits[h];
+
+		if (hit->offset < anchor || hit->record >= index->nrecords) {
+			continue;
+		}
+
+		const struct gene_node *node = index->records[hit->record];
+		size_t at = hit->offset - anchor;
+
+		if (at + len > node->sequence_len ||
+		    (other_count != UINT64_MAX &&
+		     !find_hit(index, other_bucket, hit->record, at + other))) {
+			continue;
+		}
+
+		/* fetch just the context of the candidate, then verify it */
+		size_t begin, end;
+		search_context(node->sequence_len, at, len, &begin, &end);
+
+		const char *context = gene_node_window(node, begin, end - begin);
+		if (context == NULL) {
+			fprintf(stderr, "error: unable to read sequence of %.*s\n",
+				(int) node->defline_len, node->defline);
+			return -1;
+		}
+
+		if (memcmp(context + (at - begin), pattern, len) != 0) {
+			continue;
+		}
+
+		if (hit->record != last_record) {
+			search_write_record(search->result.out, node);
+			last_record = hit->record;
+			++nrecords;
+		}
+		search_write_match(search->result.out, context, begin, end, node->sequence_len, at, len, NULL);
+		++(search->result.nmatches);
+	}
+
+	search->result.nrecords += nrecords;
+	return nrecords;
+}
+
+void kmer_index_free (struct kmer_index *index)
+{
+	if (index != NULL) {
+		if (index->map != NULL) {
+			unmap_file(index->map);
+		}
+		else {
+			free((void *) index->starts);
+			free((void *) index->hits);
+		}
+		free(index->records);
+	}
+	free(index);
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* index with TREE's nodes ranked in defline order and its checksum,
+   but no postings */
+static struct kmer_index *new_index (const struct gene_tree *tree, unsigned k)
+{
+	struct kmer_index *index = calloc(1, sizeof(*index));
+	struct tree_cursor cursor;
+
+	if (index == NULL) {
+		return NULL;
+	}
+	else if (tree->size > UINT32_MAX) {
+		fputs("error: too many sequences for k-mer index\n", stderr);
+		free(index);
+		return NULL;
+	}
+
+	index->k = k;
+	index->records = malloc((tree->size ? tree->size : 1) * sizeof(*index->records));
+
+	if (index->records == NULL || cursor_init(&cursor, tree) == -1) {
+		kmer_index_free(index);
+		return NULL;
+	}
+
+	/* hash deflines, lengths and bases, so that a saved index no longer
+	   matches once any sequence is edited */
+	uint64_t checksum = 0xcbf29ce484222325ULL;
+	struct gene_node *node;
+
+	while ((node = cursor_next(&cursor)) != NULL) {
+		const char *sequence = gene_node_sequence(node);
+
+		if (sequence == NULL) {
+			fprintf(stderr, "error: unable to read sequence of %.*s\n",
+				(int) node->defline_len, node->defline);
+			cursor_free(&cursor);
+			kmer_index_free(index);
+			return NULL;
+		}
+
+		checksum = hash_bytes(checksum, node->defline, node->defline_len);
+		checksum = (checksum ^ node->sequence_len) * FNV_PRIME;
+		checksum = hash_bytes(checksum, sequence, node->sequence_len);
+
+		index->records[index->nrecords++] = node;
+	}
+	cursor_free(&cursor);
+
+	index->checksum = checksum;
+	return index;
+}
+
+/* Fold LEN BYTES into HASH, FNV-1a style but a word at a time, rotating
+   so that every bit of a word reaches the low bits of the hash. */
+static uint64_t hash_bytes (uint64_t hash, const char *bytes, size_t len)
+{
+	size_t i = 0;
+
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t word;
+
+		memcpy(&word, bytes + i, sizeof(word));
+		hash ^= word;
+		hash = ((hash << 29) | (hash >> 35)) * FNV_PRIME;
+	}
+	for (; i < len; i++) {
+		hash = (hash ^ (unsigned char) bytes[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t kmer_bucket (const struct kmer_index *index, uint64_t code)
+{
+	if (index->bits == 2 * index->k) {
+		return code;
+	}
+	return (code * 0x9e3779b97f4a7c15ULL) >> (64 - index->bits);
+}
+
+/* Walk every k-mer of every record. With HITS NULL, count bucket sizes
+   into STARTS[b + 2]; otherwise place hits at STARTS[b + 1]++. */
+static long scan_kmers (struct kmer_index *index, uint64_t *starts, struct kmer_hit *hits)
+{
+	const uint64_t mask = (index->k == 32) ? ~(uint64_t) 0 : ((uint64_t) 1 << (2 * index->k)) - 1;
+
+	for (size_t r = 0; r < index->nrecords; r++) {
+		const struct gene_node *node = index->records[r];
+		const char *sequence = gene_node_sequence(node);
+		uint64_t code = 0;
+		size_t valid = 0;
+
+		if (sequence == NULL) {
+			return -1;
+		}
+
+		for (size_t i = 0; i < node->sequence_len; i++) {
+			uint8_t base = base_code[(unsigned char) sequence[i]];
+
+			if (base == 0) {
+				code = 0;
+				valid = 0;
+				continue;
+			}
+
+			code = ((code << 2) | (base - 1)) & mask;
+			if (++valid < index->k) {
+				continue;
+			}
+
+			uint64_t bucket = kmer_bucket(index, code);
+			if (hits == NULL) {
+				++starts[bucket + 2];
+			}
+			else {
+				struct kmer_hit *hit = &hits[starts[bucket + 1]++];
+				hit->record = r;
+				hit->offset = i + 1 - index->k;
+			}
+		}
+	}
+	return 0;
+}
+
+/* binary search BUCKET, which is sorted by (record, offset) */
+static int find_hit (const struct kmer_index *index, uint64_t bucket, uint32_t record, uint32_t offset)
+{
+	uint64_t lo = index->starts[bucket];
+	uint64_t hi = index->starts[bucket + 1];
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		const struct kmer_hit *hit = &index->hits[mid];
+
+		if (hit->record < record || (hit->record == record && hit->offset < offset)) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	return lo < index->starts[bucket + 1] &&
+		index->hits[lo].record == record && index->hits[lo].offset == offset;
+}
+
+/* Do STARTS, NBUCKETS + 1 bucket boundaries read from a file, run from 0
+   to NHITS without going backwards, so every bucket lies within the hits? */
+static int starts_valid (const uint64_t *starts, size_t nbuckets, uint64_t nhits)
+{
+	if (starts[0] != 0 || starts[nbuckets] != nhits) {
+		return 0;
+	}
+	for (size_t b = 0; b < nbuckets; b++) {
+		if (starts[b + 1] < starts[b]) {
+			return 0;
+		}
+	}
+	return 1;
+}
@@ -10,8 +10,11 @@
 #endif /* __STRICT_ANSI__ */
 
 #include <fproc.h>
+#include <kmerindex.h>
+#include <parse.h>
 
-#define BUF_MAX 80
+/* long enough for a batch of IDs to `get' on one line */
+#define BUF_MAX 65536
 
 void print_welcome (void)
 {
@@ -30,19 +33,53 @@ void print_help (void)
 {
 	fputs("fproc - a terminal-based program for FASTA file manipulation.\n\n", stdout);
 	fputs("List of commands:\n\n" \
-	      "\tread FILE               read in and store contents of FILE\n"\
-	      "\tread-to FILE N          read in and store contents of FILE in buffer N, if free\n"
+	      "\tread FILE [T] [lazy]    read in and store contents of FILE, using T threads\n"\
+	      "\tread-to FILE N [T] [lazy]\n"\
+	      "\t                        read in and store contents of FILE in buffer N, if free\n"\
+	      "\tindex FILE              index FILE, for reading without parsing or lazily\n"
+	      "\tsave N FILE             save file N as a snapshot FILE, for fast loading\n"\
+	      "\tload FILE               load snapshot FILE saved by `save'\n"\
 	      "\tprint N                 print description lines from file N\n"\
-	      "\tprint-all N             print description lines and sequences from file N\n"\
+	      "\tprint-all N [W]         print description lines and sequences from file N\n"\
 	      "\tlist                    print contents of file buffer\n"\
-	      "\twrite N FILE            write contents of file N to output file FILE\n"	\
+	      "\twrite N FILE [W] [direct|bgzf]\n"\
+	      "\t                        write contents of file N to output file FILE,\n"\
+	      "\t                        bypassing the page cache (direct) or BGZF compressed\n"	\
 	      "\tmerge N1 N2             merge contents of file N1 into file N2\n"\
+	      "\tmerge-all [N1 N2 ...]   merge files N2... (default: all files) into file N1\n"\
+	      "\tpack N                  store DNA sequences in file N at 2 bits per base\n"\
+	      "\tindex-label N [MODE]    index file N by accession (default) or full description line\n"\
+	      "\tindex-kmer N K [FILE]   index sequences in file N by K-mer, cached in FILE\n"\
+	      "\tget N ID [ID ...]       print records in file N with accession (or description) ID\n"\
+	      "\textract N REGION [...] [bed FILE] [rc]\n"\
+	      "\t                        print REGIONs (ID:START-END) of records in file N,\n"\
+	      "\t                        or those listed in BED FILE, reverse complemented (rc)\n"\
+	      "\tprefix N STRING         print records in file N whose description starts with STRING\n"\
+	      "\trange N FROM TO         print records in file N with FROM <= description < TO\n"\
 	      "\tsearch-label N STRING   search file N for description lines containing STRING\n"\
-	      "\tsearch-seq N STRING     search file N for sequences containing STRING\n"\
+	      "\tsearch-seq N STRING [MODE]\n"\
+	      "\t                        search file N for sequences containing STRING, read\n"\
+	      "\t                        as IUPAC codes on one (iupac) or both (both) strands\n"\
+	      "\tsearch-seq-fm N STRING [locate]\n"\
+	      "\t                        count (or list) occurrences of STRING in file N by FM-index\n"\
+	      "\tsearch-seq-approx N STRING K\n"\
+	      "\t                        search file N for sequences within K edits of STRING\n"\
+	      "\tsearch-seq-multi N FILE search file N for every pattern in FILE at once\n"\
+	      "\tbudget [SIZE|off]       limit memory used by files to SIZE bytes (or K, M, G),\n"\
+	      "\t                        or show the limit and sequence cache counters\n"\
 	      "\tdelete N                delete file N from file buffer\n"\
 	      "\tdelete-all              delete all files from file buffer\n\n"\
 	      "\thelp                    display this help message\n"\
 	      "\tcredits                 display credits\n\n", stdout);
+	fputs("T defaults to the number of online processors.\n", stdout);
+	fputs("FILEs to read may be gzip or BGZF compressed.\n", stdout);
+	fputs("A lazy read keeps only description lines in memory, reading sequences\n"\
+	      "from FILE as they are needed; it indexes FILE first if need be.\n", stdout);
+	fputs("Under a memory budget, files that don't fit are read lazily, buffers\n"\
+	      "that don't fit have their sequences dropped to be read lazily too, and\n"\
+	      "the sequences most recently read are kept in whatever memory is left.\n", stdout);
+	fputs("W wraps sequences at W bases per line; by default each is on one line.\n", stdout);
+	fputs("Pattern FILEs are FASTA, or one pattern per line.\n", stdout);
 	      
 	fputs("Use `quit' or `Ctrl-D' to exit.\n\n", stdout);
 }
@@ -52,11 +89,55 @@ void print_credits (void)
 	fputs("Written by Alexander Moore, Dec 2019\n", stdout);
 }
 
+/* Parse the rest of a read command: a thread count and `lazy', in either
+   order. Return 0 on success, -1 (having said why) if either is invalid. */
+static int read_options (unsigned long int *nthreads, int *lazy)
+{
+	char *option;
+
+	while ((option = strtok(NULL, " \t\n")) != NULL) {
+		if (!strcmp(option, "lazy")) {
+			*lazy = 1;
+		}
+		else if ((*nthreads = strtoul(option, NULL, 10)) == 0) {
+			fprintf(stdout, "%s is not a valid thread count\n", option);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Parse SIZE, a number of bytes optionally followed by K, M, G or T for
+   powers of 1024, into *BYTES. Return 0 on success, -1 if it is invalid. */
+static int parse_size (const char *size, size_t *bytes)
+{
+	char *end;
+	unsigned long long value = strtoull(size, &end, 10);
+	unsigned shift = 0;
+
+	if (end == size || *size == '-') {
+		return -1;
+	}
+
+	switch (*end) {
+	case 'k': case 'K': shift = 10; ++end; break;
+	case 'm': case 'M': shift = 20; ++end; break;
+	case 'g': case 'G': shift = 30; ++end; break;
+	case 't': case 'T': shift = 40; ++end; break;
+	}
+
+	if (*end != '\0' || value > ((size_t) -1 >> shift)) {
+		return -1;
+	}
+	*bytes = (size_t) value << shift;
+	return 0;
+}
+
 int main (void)
 {
 	print_welcome();
 
-	char termbuf[BUF_MAX];
+	static char termbuf[BUF_MAX];
 	char *token;
 
 	while (1) {
@@ -87,12 +168,14 @@ int main (void)
 		/* parse input */
 		else if (!strcmp(token, "read")) {
 			char *infile = strtok(NULL, " \t\n");
+			unsigned long int nthreads = default_thread_count();
+			int lazy = 0;
 
 			if (infile == NULL) {
 				fputs("input file required\n", stdout);
 			}
-			else {
-				fproc_read(infile);
+			else if (read_options(&nthreads, &lazy) == 0) {
+				fproc_read(infile, nthreads, lazy);
 			}
 			continue;
 		}
@@ -101,6 +184,8 @@ int main (void)
 			char *destbuf;
 			
 			unsigned long int destN;
+			unsigned long int nthreads = default_thread_count();
+			int lazy = 0;
 
 			if (infile == NULL) {
 				fputs("input file required\n", stdout);
@@ -111,12 +196,52 @@ int main (void)
 			else if ((destN = strtoul(destbuf, NULL, 10)) == 0) {
 				fprintf(stdout, "%s is not a valid number\n", destbuf);
 			}
+			else if (read_options(&nthreads, &lazy) == 0) {
+				fproc_read_n(infile, destN - 1, nthreads, lazy);
+			}
+			continue;
+		}
+		else if (!strcmp(token, "index")) {
+			char *infile = strtok(NULL, " \t\n");
+
+			if (infile == NULL) {
+				fputs("input file required\n", stdout);
+				fputs("usage: `index file'\n", stdout);
+			}
 			else {
-				fproc_read_n(infile, destN - 1);
+				fproc_index(infile);
+			}
+			continue;
+		}
+		else if (!strcmp(token, "load")) {
+			char *infile = strtok(NULL, " \t\n");
+
+			if (infile == NULL) {
+				fputs("snapshot file required\n", stdout);
+				fputs("usage: `load file'\n", stdout);
+			}
+			else {
+				fproc_load(infile);
+			}
+			continue;
+		}
+		else if (!strcmp(token, "save")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			char *outfile = strtok(NULL, " \t\n");
+			unsigned long int srcN;
+
+			if (srcfile == NULL || outfile == NULL) {
+				fputs("source buffer number and output filename required\n", stdout);
+				fputs("usage: `save n file'\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else {
+				fproc_save(srcN - 1, outfile);
 			}
 			continue;
 		}
-		
 		else if (!strcmp(token, "print")) {
 			char *infile = strtok(NULL, " \t\n");
 			unsigned long int srcN;
@@ -135,17 +260,21 @@ int main (void)
 		
 		else if (!strcmp(token, "print-all")) {
 			char *infile = strtok(NULL, " \t\n");
+			char *width = strtok(NULL, " \t\n");
 			unsigned long int srcN;
 
 			if (infile == NULL) {
 				fputs("file buffer no. required\n", stdout);
-				fputs("usage: `print-all n'\n", stdout);
+				fputs("usage: `print-all n [w]'\n", stdout);
 			}
 			else if ((srcN = strtoul(infile, NULL, 10)) == 0) {
 				fprintf(stdout, "%s is not a valid buffer number.\n", infile);
 			}
+			else if (width != NULL && (width[strspn(width, "0123456789")] != '\0' || strtoul(width, NULL, 10) == 0)) {
+				fprintf(stdout, "%s is not a valid line width\n", width);
+			}
 			else {
-				fproc_print_all(srcN - 1);
+				fproc_print_all(srcN - 1, (width == NULL) ? 0 : strtoul(width, NULL, 10));
 			}
 			continue;
 		}
@@ -157,21 +286,46 @@ int main (void)
 		else if (!strcmp(token, "write")) {
 			char *infile = strtok(NULL, " \t\n");
 			char *outfile = strtok(NULL, " \t\n");
+			char *option;
 			unsigned long int srcN;
+			unsigned long int wrap = 0;
+			int direct = 0;
+			int bgzf = 0;
+			int valid = 1;
+
+			/* any of a line width, `direct' and `bgzf', in any order */
+			while (valid && (option = strtok(NULL, " \t\n")) != NULL) {
+				if (!strcmp(option, "direct")) {
+					direct = 1;
+				}
+				else if (!strcmp(option, "bgzf")) {
+					bgzf = 1;
+				}
+				else if (option[strspn(option, "0123456789")] == '\0' && strtoul(option, NULL, 10) > 0) {
+					wrap = strtoul(option, NULL, 10);
+				}
+				else {
+					fprintf(stdout, "%s is not a valid line width or option\n", option);
+					valid = 0;
+				}
+			}
 
 			if (infile == NULL) {
 				fputs("source buffer number required\n", stdout);
-				fputs("usage: `write n file'\n", stdout);
+				fputs("usage: `write n file [w] [direct|bgzf]'\n", stdout);
 			}
 			else if (outfile == NULL) {
 				fputs("output filename required\n", stdout);
-				fputs("usage: `write n file'\n", stdout);
+				fputs("usage: `write n file [w] [direct|bgzf]'\n", stdout);
 			}
 			else if ((srcN = strtoul(infile, NULL, 10)) == 0) {
 				fprintf(stdout, "%s is not a valid buffer number\n", infile);
 			}
-			else {
-				fproc_write(srcN - 1, outfile);
+			else if (direct && bgzf) {
+				fputs("direct and bgzf can't be used together\n", stdout);
+			}
+			else if (valid) {
+				fproc_write(srcN - 1, outfile, wrap, direct, bgzf ? default_thread_count() : 0);
 			}
 			continue;
 		}
@@ -195,6 +349,183 @@ int main (void)
 			}
 			continue;
 		}
+		else if (!strcmp(token, "merge-all")) {
+			char *buffer;
+			static size_t srcN[BUF_MAX / 2 + 1];
+			size_t n = 0;
+			int valid = 1;
+
+			while (valid && (buffer = strtok(NULL, " \t\n")) != NULL) {
+				if ((srcN[n] = strtoul(buffer, NULL, 10)) == 0) {
+					fprintf(stdout, "%s is not a valid buffer number\n", buffer);
+					valid = 0;
+				}
+				else {
+					--srcN[n++];
+				}
+			}
+
+			if (valid) {
+				fproc_merge_all(srcN, n, default_thread_count());
+			}
+			continue;
+		}
+		else if (!strcmp(token, "pack")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			unsigned long int srcN;
+
+			if (srcfile == NULL) {
+				fputs("source buffer number required\n", stdout);
+				fputs("usage: pack n\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else {
+				fproc_pack(srcN - 1);
+			}
+			continue;
+		}
+		else if (!strcmp(token, "index-label")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			char *mode = strtok(NULL, " \t\n");
+			unsigned long int srcN;
+
+			if (srcfile == NULL) {
+				fputs("source buffer number required\n", stdout);
+				fputs("usage: index-label n [accession|full]\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else if (mode != NULL && strcmp(mode, "accession") && strcmp(mode, "full")) {
+				fprintf(stdout, "%s is not a valid index mode\n", mode);
+				fputs("usage: index-label n [accession|full]\n", stdout);
+			}
+			else {
+				fproc_index_label(srcN - 1, (mode != NULL && !strcmp(mode, "full")) ?
+						  INDEX_DEFLINE : INDEX_ACCESSION);
+			}
+			continue;
+		}
+		else if (!strcmp(token, "index-kmer")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			char *kstring = strtok(NULL, " \t\n");
+			char *indexfile = strtok(NULL, " \t\n");
+			unsigned long int srcN;
+			unsigned long int k;
+
+			if (srcfile == NULL || kstring == NULL) {
+				fputs("source buffer number and k-mer length required\n", stdout);
+				fputs("usage: index-kmer n k [file]\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else if ((k = strtoul(kstring, NULL, 10)) < KMER_MIN || k > KMER_MAX) {
+				fprintf(stdout, "%s is not a valid k-mer length (%d to %d)\n",
+					kstring, KMER_MIN, KMER_MAX);
+			}
+			else {
+				fproc_index_kmer(srcN - 1, k, indexfile);
+			}
+			continue;
+		}
+		else if (!strcmp(token, "get")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			static char *ids[BUF_MAX / 2 + 1];
+			size_t n = 0;
+			unsigned long int srcN;
+
+			while ((ids[n] = strtok(NULL, " \t\n")) != NULL) {
+				++n;
+			}
+
+			if (srcfile == NULL || n == 0) {
+				fputs("source buffer number and at least one ID required\n", stdout);
+				fputs("usage: get n id [id ...]\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else {
+				fproc_get(srcN - 1, ids, n);
+			}
+			continue;
+		}
+		else if (!strcmp(token, "extract")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			static char *regions[BUF_MAX / 2 + 1];
+			char *bedfile = NULL;
+			size_t n = 0;
+			int revcomp = 0;
+			unsigned long int srcN;
+
+			/* regions, `rc' and `bed FILE', in any order */
+			while ((regions[n] = strtok(NULL, " \t\n")) != NULL) {
+				if (!strcmp(regions[n], "rc")) {
+					revcomp = 1;
+				}
+				else if (!strcmp(regions[n], "bed")) {
+					bedfile = strtok(NULL, " \t\n");
+				}
+				else {
+					++n;
+				}
+			}
+
+			if (srcfile == NULL || (n == 0 && bedfile == NULL)) {
+				fputs("source buffer number and at least one region or BED file required\n", stdout);
+				fputs("usage: extract n id:start-end [...] [bed file] [rc]\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else {
+				if (n > 0) {
+					fproc_extract(srcN - 1, regions, n, revcomp);
+				}
+				if (bedfile != NULL) {
+					fproc_extract_bed(srcN - 1, bedfile, revcomp);
+				}
+			}
+			continue;
+		}
+		else if (!strcmp(token, "prefix")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			char *prefix = strtok(NULL, " \t\n");
+			unsigned long int srcN;
+
+			if (srcfile == NULL || prefix == NULL) {
+				fputs("source buffer number and prefix required\n", stdout);
+				fputs("usage: prefix n string\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else {
+				fproc_prefix(srcN - 1, prefix);
+			}
+			continue;
+		}
+		else if (!strcmp(token, "range")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			char *from = strtok(NULL, " \t\n");
+			char *to = strtok(NULL, " \t\n");
+			unsigned long int srcN;
+
+			if (srcfile == NULL || from == NULL || to == NULL) {
+				fputs("source buffer number and two bounds required\n", stdout);
+				fputs("usage: range n from to\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else {
+				fproc_range(srcN - 1, from, to);
+			}
+			continue;
+		}
 		else if (!strcmp(token, "search-label")) {
 			char *srcfile = strtok(NULL, " \t\n");
 			char *string;
@@ -219,24 +550,115 @@ int main (void)
 		else if (!strcmp(token, "search-seq")) {
 			char *srcfile = strtok(NULL, " \t\n");
 			char *string;
+			char *mode;
 			unsigned long int srcN;
 
 			if (srcfile == NULL) {
 				fputs("source buffer number required\n", stdout);
-				fputs("usage: search-seq n string\n", stdout);
+				fputs("usage: search-seq n string [iupac|both]\n", stdout);
 			}
 			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
 				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
 			}
 			else if ((string = strtok(NULL, " \t\n")) == NULL) {
 				fputs("search string required\n", stdout);
-				fputs("usage: search-seq n string\n", stdout);
+				fputs("usage: search-seq n string [iupac|both]\n", stdout);
 			}
-			else {
+			else if ((mode = strtok(NULL, " \t\n")) == NULL) {
 				fproc_search_sequence(srcN - 1, string);
 			}
+			else if (!strcmp(mode, "iupac") || !strcmp(mode, "both")) {
+				fproc_search_strands(srcN - 1, string, !strcmp(mode, "both"));
+			}
+			else {
+				fprintf(stdout, "%s is not a valid search mode\n", mode);
+				fputs("usage: search-seq n string [iupac|both]\n", stdout);
+			}
+		}
+
+		else if (!strcmp(token, "search-seq-fm")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			char *string = strtok(NULL, " \t\n");
+			char *mode = strtok(NULL, " \t\n");
+			unsigned long int srcN;
+
+			if (srcfile == NULL || string == NULL) {
+				fputs("source buffer number and search string required\n", stdout);
+				fputs("usage: search-seq-fm n string [locate]\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else if (mode != NULL && strcmp(mode, "locate")) {
+				fprintf(stdout, "%s is not a valid search mode\n", mode);
+				fputs("usage: search-seq-fm n string [locate]\n", stdout);
+			}
+			else {
+				fproc_search_fm(srcN - 1, string, mode != NULL);
+			}
+		}
+
+		else if (!strcmp(token, "search-seq-approx")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			char *string = strtok(NULL, " \t\n");
+			char *kstring = strtok(NULL, " \t\n");
+			unsigned long int srcN;
+
+			if (srcfile == NULL || string == NULL || kstring == NULL) {
+				fputs("source buffer number, search string and edit limit required\n", stdout);
+				fputs("usage: search-seq-approx n string k\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else if (kstring[strspn(kstring, "0123456789")] != '\0') {
+				fprintf(stdout, "%s is not a valid edit limit\n", kstring);
+			}
+			else {
+				fproc_search_approx(srcN - 1, string, strtoul(kstring, NULL, 10));
+			}
+		}
+
+		else if (!strcmp(token, "search-seq-multi")) {
+			char *srcfile = strtok(NULL, " \t\n");
+			char *patternfile;
+			unsigned long int srcN;
+
+			if (srcfile == NULL) {
+				fputs("source buffer number required\n", stdout);
+				fputs("usage: search-seq-multi n patternfile\n", stdout);
+			}
+			else if ((srcN = strtoul(srcfile, NULL, 10)) == 0) {
+				fprintf(stdout, "%s is not a valid buffer number\n", srcfile);
+			}
+			else if ((patternfile = strtok(NULL, " \t\n")) == NULL) {
+				fputs("pattern file required\n", stdout);
+				fputs("usage: search-seq-multi n patternfile\n", stdout);
+			}
+			else {
+				fproc_search_multi(srcN - 1, patternfile);
+			}
 		}
 
+		else if (!strcmp(token, "budget")) {
+			char *size = strtok(NULL, " \t\n");
+			size_t budget;
+
+			if (size == NULL) {
+				fproc_memory();
+			}
+			else if (!strcmp(size, "off")) {
+				fproc_budget(0);
+			}
+			else if (parse_size(size, &budget) == -1 || budget == 0) {
+				fprintf(stdout, "%s is not a valid memory budget\n", size);
+				fputs("usage: budget [size[k|m|g|t]|off]\n", stdout);
+			}
+			else {
+				fproc_budget(budget);
+			}
+			continue;
+		}
 		else if (!strcmp(token, "delete")) {
 			char *filename = strtok(NULL, " \t\n");
 			unsigned long int srcN;
@@ -0,0 +1,183 @@
+/* mapfile.c - map input files into memory for zero-copy parsing */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bgzf.h>
+#include <mapfile.h>
+#include <seqcache.h>
+
+static int read_whole_file (int fd, struct gene_map *map);
+
+/* Map FILENAME copy-on-write, falling back to reading it into the heap.
+   Return NULL on failure. */
+struct gene_map *map_file (const char *filename)
+{
+	int fd;
+	struct stat st;
+
+	if ((fd = open(filename, O_RDONLY)) == -1) {
+		fprintf(stderr, "unable to open file %s\n", filename);
+		return NULL;
+	}
+
+	struct gene_map *map = malloc(sizeof(*map));
+	if (map == NULL) {
+		close(fd);
+		return NULL;
+	}
+	map->addr = NULL;
+	map->len = 0;
+	map->mapped = 0;
+	map->fd = -1;
+	map->next = NULL;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		/* private and writable, so the parser can join wrapped lines in place
+		   without touching the file */
+		void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED) {
+			/* the parser makes a single forward pass */
+			madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+			map->addr = addr;
+			map->len = st.st_size;
+			map->mapped = 1;
+
+			close(fd);
+			return map;
+		}
+	}
+
+	/* not mappable - read into heap buffer instead */
+	if (read_whole_file(fd, map) == -1) {
+		fprintf(stderr, "unable to read file %s\n", filename);
+		free(map);
+		map = NULL;
+	}
+
+	close(fd);
+	return map;
+}
+
+struct gene_map *open_file (const char *filename)
+{
+	struct gene_map *map = calloc(1, sizeof(*map));
+
+	if (map == NULL) {
+		return NULL;
+	}
+	else if ((map->fd = open(filename, O_RDONLY)) == -1) {
+		fprintf(stderr, "unable to open file %s\n", filename);
+		free(map);
+		return NULL;
+	}
+	return map;
+}
+
+struct gene_map *map_input (const char *filename, size_t nthreads)
+{
+	struct gene_map *map = map_file(filename);
+
+	if (map == NULL || !bgzf_is_gzip(map->addr, map->len)) {
+		return map;
+	}
+
+	char *text;
+	size_t text_len;
+
+	if (bgzf_decompress(map->addr, map->len, nthreads, &text, &text_len) == -1) {
+		fprintf(stderr, "unable to decompress file %s\n", filename);
+		unmap_file(map);
+		return NULL;
+	}
+
+	/* the compressed bytes are no longer needed */
+	if (map->mapped) {
+		munmap(map->addr, map->len);
+	}
+	else {
+		free(map->addr);
+	}
+
+	map->addr = text;
+	map->len = text_len;
+	map->mapped = 0;
+	return map;
+}
+
+void unmap_file (struct gene_map *map)
+{
+	if (map != NULL) {
+		if (map->mapped) {
+			munmap(map->addr, map->len);
+		}
+		else {
+			free(map->addr);
+		}
+		map->addr = NULL;
+
+		if (map->fd != -1) {
+			/* cached sequences are keyed by the nodes read from FD */
+			seq_cache_drop(map->fd);
+			close(map->fd);
+		}
+	}
+	free(map);
+}
+
+void unmap_file_list (struct gene_map *map)
+{
+	while (map != NULL) {
+		struct gene_map *next = map->next;
+		unmap_file(map);
+		map = next;
+	}
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* Read FD to EOF into a heap buffer owned by MAP.
+   Return 0 on success, -1 on failure. */
+static int read_whole_file (int fd, struct gene_map *map)
+{
+	size_t cap = 1 << 16;
+	char *buf = malloc(cap);
+
+	if (buf == NULL) {
+		return -1;
+	}
+
+	size_t len = 0;
+	ssize_t nread;
+
+	while ((nread = read(fd, buf + len, cap - len)) != 0) {
+		if (nread == -1) {
+			free(buf);
+			return -1;
+		}
+
+		len += nread;
+		if (len == cap) {
+			/* need a temporary buffer, since realloc leaves BUF unchanged on failure */
+			char *tmp_buf = realloc(buf, 2 * cap);
+			if (tmp_buf == NULL) {
+				free(buf);
+				return -1;
+			}
+			buf = tmp_buf;
+			cap *= 2;
+		}
+	}
+
+	map->addr = buf;
+	map->len = len;
+	return 0;
+}
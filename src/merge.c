@@ -0,0 +1,300 @@
+/* merge.c - parallel k-way merge of gene_trees */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include <genetree.h>
+#include <dsw.h>
+#include <hashindex.h>
+#include <merge.h>
+
+/* sorted run of nodes from one tree */
+struct node_run {
+	struct gene_node **begin;
+	struct gene_node **end;
+	size_t src; /* index of tree, for breaking ties */
+};
+
+/*
+ * Every thread takes one range of keys, bounded by splitter nodes, and
+ * merges that range of every tree into its own stretch of OUT starting at
+ * OUT_BEGIN. Ranges are disjoint and in order, so concatenating the
+ * outputs gives the full merge.
+ */
+struct merge_job {
+	struct node_run *runs; /* one per tree, restricted to this range */
+	size_t nruns;
+
+	struct gene_node **out;
+	size_t nout;
+};
+
+struct flatten_job {
+	struct gene_tree *tree;
+	struct gene_node **out;
+};
+
+static int run_before (const struct node_run *r1, const struct node_run *r2);
+static void sift_down (struct node_run **heap, size_t n, size_t i);
+static struct gene_node **lower_bound (struct gene_node **begin, struct gene_node **end,
+				       const struct gene_node *key);
+static void *flatten_job_run (void *arg);
+static void *merge_job_run (void *arg);
+static void run_jobs (void *(*fn)(void *), void *jobs, size_t job_size, size_t njobs);
+
+int merge_trees (struct gene_tree **trees, size_t ntrees, size_t nthreads)
+{
+	size_t total = 0;
+	size_t largest = 0;
+
+	for (size_t k = 0; k < ntrees; k++) {
+		total += trees[k]->size;
+		if (trees[k]->size > trees[largest]->size) {
+			largest = k;
+		}
+	}
+
+	if (nthreads == 0) {
+		nthreads = 1;
+	}
+	if (nthreads > total / 1024 + 1) {
+		/* not worth a thread per thousand nodes */
+		nthreads = total / 1024 + 1;
+	}
+
+	/* allocate everything before any tree is touched */
+	struct gene_node **views = malloc((total + 1) * sizeof(*views));
+	struct gene_node **out = malloc((total + 1) * sizeof(*out));
+	struct flatten_job *flatten = calloc(ntrees, sizeof(*flatten));
+	struct merge_job *jobs = calloc(nthreads, sizeof(*jobs));
+	struct node_run *runs = calloc(nthreads * ntrees, sizeof(*runs));
+	struct gene_node ***view_begin = calloc(ntrees, sizeof(*view_begin));
+
+	if (views == NULL || out == NULL || flatten == NULL || jobs == NULL ||
+	    runs == NULL || view_begin == NULL) {
+		fprintf(stderr, "merge error: out of memory\n");
+		free(views);
+		free(out);
+		free(flatten);
+		free(jobs);
+		free(runs);
+		free(view_begin);
+		return -1;
+	}
+
+	/* in-order view of every tree, flattened concurrently */
+	struct gene_node **next = views;
+	for (size_t k = 0; k < ntrees; k++) {
+		view_begin[k] = next;
+		flatten[k].tree = trees[k];
+		flatten[k].out = next;
+		next += trees[k]->size;
+	}
+	run_jobs(&flatten_job_run, flatten, sizeof(*flatten), ntrees);
+
+	/* split the key space at evenly spaced nodes of the largest tree, and
+	   find where each split falls in every other tree */
+	size_t out_offset = 0;
+
+	for (size_t t = 0; t < nthreads; t++) {
+		struct merge_job *job = &jobs[t];
+		struct gene_node **largest_view = view_begin[largest];
+		size_t largest_size = trees[largest]->size;
+
+		const struct gene_node *lo = (t == 0) ? NULL
+			: largest_view[largest_size * t / nthreads];
+		const struct gene_node *hi = (t + 1 == nthreads) ? NULL
+			: largest_view[largest_size * (t + 1) / nthreads];
+
+		job->runs = &runs[t * ntrees];
+		job->nruns = ntrees;
+		job->out = out + out_offset;
+
+		for (size_t k = 0; k < ntrees; k++) {
+			struct gene_node **begin = view_begin[k];
+			struct gene_node **end = begin + trees[k]->size;
+			struct node_run *run = &job->runs[k];
+
+			run->begin = (lo == NULL) ? begin : lower_bound(begin, end, lo);
+			run->end = (hi == NULL) ? end : lower_bound(begin, end, hi);
+			run->src = k;
+
+			out_offset += run->end - run->begin;
+		}
+	}
+	run_jobs(&merge_job_run, jobs, sizeof(*jobs), nthreads);
+
+	/* close the gaps left by duplicates between the per-thread outputs */
+	size_t nmerged = 0;
+	for (size_t t = 0; t < nthreads; t++) {
+		for (size_t i = 0; i < jobs[t].nout; i++) {
+			out[nmerged++] = jobs[t].out[i];
+		}
+	}
+
+	trees[0]->root = build_balanced_tree(out, nmerged);
+	trees[0]->size = nmerged;
+
+	/* nodes from the other trees are scattered through the result, so
+	   rebuilding the index is as cheap as patching it */
+	if (trees[0]->index != NULL) {
+		struct gene_index *index = index_build(trees[0], trees[0]->index->key);
+
+		if (index == NULL) {
+			fprintf(stderr, "warning: out of memory rebuilding index of %s, index dropped\n",
+				trees[0]->filename);
+		}
+		index_free(trees[0]->index);
+		trees[0]->index = index;
+	}
+
+	for (size_t k = 1; k < ntrees; k++) {
+		gene_tree_adopt(trees[0], trees[k]);
+
+		trees[k]->root = NULL;
+		trees[k]->size = 0;
+		free_gene_tree(trees[k]);
+		trees[k] = NULL;
+	}
+
+	free(views);
+	free(out);
+	free(flatten);
+	free(jobs);
+	free(runs);
+	free(view_begin);
+	return 0;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* order runs by their head node, then by tree so earlier trees win ties */
+static int run_before (const struct node_run *r1, const struct node_run *r2)
+{
+	int cmp = genecmp(*r1->begin, *r2->begin);
+
+	return (cmp < 0) || (cmp == 0 && r1->src < r2->src);
+}
+
+static void sift_down (struct node_run **heap, size_t n, size_t i)
+{
+	while (1) {
+		size_t min = i;
+		size_t left = 2 * i + 1;
+		size_t right = 2 * i + 2;
+
+		if (left < n && run_before(heap[left], heap[min])) {
+			min = left;
+		}
+		if (right < n && run_before(heap[right], heap[min])) {
+			min = right;
+		}
+		if (min == i) {
+			return;
+		}
+
+		struct node_run *tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/* first node in sorted [BEGIN, END) not less than KEY */
+static struct gene_node **lower_bound (struct gene_node **begin, struct gene_node **end,
+				       const struct gene_node *key)
+{
+	while (begin < end) {
+		struct gene_node **mid = begin + (end - begin) / 2;
+
+		if (genecmp(*mid, key) < 0) {
+			begin = mid + 1;
+		}
+		else {
+			end = mid;
+		}
+	}
+	return begin;
+}
+
+static void *flatten_job_run (void *arg)
+{
+	struct flatten_job *job = arg;
+	struct gene_tree *tree = job->tree;
+
+	/* the vine is the tree in order, linked through right pointers */
+	tree_to_vine(tree);
+
+	size_t i = 0;
+	for (struct gene_node *node = tree->root; node != NULL; node = node->right) {
+		job->out[i++] = node;
+	}
+	return NULL;
+}
+
+/* k-way merge of JOB's runs through a binary heap keyed on each run's head */
+static void *merge_job_run (void *arg)
+{
+	struct merge_job *job = arg;
+	struct node_run *heap_space[job->nruns];
+	struct node_run **heap = heap_space;
+	size_t n = 0;
+
+	for (size_t k = 0; k < job->nruns; k++) {
+		if (job->runs[k].begin < job->runs[k].end) {
+			heap[n++] = &job->runs[k];
+		}
+	}
+	for (size_t i = n / 2; i > 0; i--) {
+		sift_down(heap, n, i - 1);
+	}
+
+	struct gene_node *last = NULL;
+	job->nout = 0;
+
+	while (n > 0) {
+		struct gene_node *node = *heap[0]->begin++;
+
+		/* equal deflines come out earliest tree first: keep only that one */
+		if (last == NULL || genecmp(last, node) != 0) {
+			job->out[job->nout++] = node;
+			last = node;
+		}
+
+		if (heap[0]->begin == heap[0]->end) {
+			heap[0] = heap[--n];
+		}
+		sift_down(heap, n, 0);
+	}
+
+	return NULL;
+}
+
+/* Run FN on each of the NJOBS jobs of JOB_SIZE bytes at JOBS, one thread
+   per job, using the calling thread for the first and for any that fail
+   to start. */
+static void run_jobs (void *(*fn)(void *), void *jobs, size_t job_size, size_t njobs)
+{
+	pthread_t threads[njobs];
+	size_t nstarted = 1;
+
+	for (size_t i = 1; i < njobs; i++) {
+		if (pthread_create(&threads[i], NULL, fn, (char *) jobs + i * job_size) != 0) {
+			break;
+		}
+		++nstarted;
+	}
+
+	for (size_t i = 0; i < njobs; i++) {
+		if (i == 0 || i >= nstarted) {
+			(*fn)((char *) jobs + i * job_size);
+		}
+	}
+	for (size_t i = 1; i < nstarted; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
@@ -0,0 +1,316 @@
+/* multisearch.c - Aho-Corasick automaton over a file of patterns */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <genetree.h>
+#include <mapfile.h>
+#include <multisearch.h>
+#include <parse.h>
+#include <search.h>
+
+static int read_pattern_lines (char *begin, char *end, struct record_list *list);
+static void add_pattern (struct pattern_set *set, const char *pattern, size_t len, size_t id);
+static int grow_states (struct pattern_set *set, size_t *capacity);
+static int link_states (struct pattern_set *set);
+static void write_match (struct search_out *out, size_t offset, const char *name, size_t len);
+
+struct pattern_set *load_patterns (const char *filename)
+{
+	struct pattern_set *set = calloc(1, sizeof(*set));
+	struct record_list list = {NULL, 0, 0};
+
+	if (set == NULL || (set->map = map_file(filename)) == NULL) {
+		free(set);
+		return NULL;
+	}
+
+	char *begin = set->map->addr;
+	char *end = begin + set->map->len;
+	char *first = begin;
+
+	while (first < end && (*first == '\n' || *first == '\r' || *first == ' ' || *first == '\t')) {
+		first++;
+	}
+
+	int status = (first < end && *first == '>') ?
+		parse_records(first, end, &list) : read_pattern_lines(begin, end, &list);
+
+	if (status == -1 || list.size == 0) {
+		fprintf(stderr, "error: no patterns found in %s\n", filename);
+		goto fail;
+	}
+
+	/* alphabet: one class per distinct byte used by any pattern */
+	set->nclasses = 1;
+	for (size_t i = 0; i < list.size; i++) {
+		for (size_t j = 0; j < list.records[i].sequence_len; j++) {
+			unsigned char c = list.records[i].sequence[j];
+			if (set->classes[c] == 0) {
+				set->classes[c] = set->nclasses++;
+			}
+		}
+	}
+
+	set->npatterns = list.size;
+	set->names = malloc(list.size * sizeof(*set->names));
+	set->name_lens = malloc(list.size * sizeof(*set->name_lens));
+	set->lengths = malloc(list.size * sizeof(*set->lengths));
+	set->next_same = malloc(list.size * sizeof(*set->next_same));
+
+	if (set->names == NULL || set->name_lens == NULL ||
+	    set->lengths == NULL || set->next_same == NULL) {
+		goto fail;
+	}
+
+	size_t capacity = 0;
+	set->nstates = 1;
+	if (grow_states(set, &capacity) == -1) {
+		goto fail;
+	}
+	set->output[0] = -1;
+
+	for (size_t i = 0; i < list.size; i++) {
+		const struct gene_record *rec = &list.records[i];
+
+		set->names[i] = rec->defline;
+		set->name_lens[i] = rec->defline_len;
+		set->lengths[i] = rec->sequence_len;
+		set->next_same[i] = -1;
+
+		/* worst case, every byte of the pattern is a new state */
+		while (set->nstates + rec->sequence_len > capacity) {
+			if (grow_states(set, &capacity) == -1) {
+				goto fail;
+			}
+		}
+		add_pattern(set, rec->sequence, rec->sequence_len, i);
+	}
+
+	if (link_states(set) == -1) {
+		goto fail;
+	}
+
+	free(list.records);
+	return set;
+
+fail:
+	free(list.records);
+	free_patterns(set);
+	return NULL;
+}
+
+void free_patterns (struct pattern_set *set)
+{
+	if (set != NULL) {
+		free(set->delta);
+		free(set->output);
+		free(set->report);
+		free(set->names);
+		free(set->name_lens);
+		free(set->lengths);
+		free(set->next_same);
+		unmap_file(set->map);
+	}
+	free(set);
+}
+
+int search_patterns (const struct gene_node *node, void *arg)
+{
+	struct multi_search *search = arg;
+	const struct pattern_set *set = search->patterns;
+	const char *sequence = gene_node_sequence(node);
+	const uint32_t *delta = set->delta;
+	const size_t nclasses = set->nclasses;
+	uint32_t state = 0;
+	int nmatches = 0;
+
+	if (sequence == NULL) {
+		fprintf(stderr, "error: unable to read sequence of %.*s\n",
+			(int) node->defline_len, node->defline);
+		return -1;
+	}
+
+	for (size_t i = 0; i < node->sequence_len; i++) {
+		state = delta[state * nclasses + set->classes[(unsigned char) sequence[i]]];
+
+		/* walk every state on the failure chain that ends a pattern */
+		for (uint32_t s = (set->output[state] >= 0) ? state : set->report[state];
+		     s != 0; s = set->report[s]) {
+
+			for (int32_t p = set->output[s]; p >= 0; p = set->next_same[p]) {
+				if (nmatches++ == 0) {
+					search_write_record(search->result.out, node);
+				}
+				write_match(search->result.out, i + 1 - set->lengths[p],
+					    set->names[p], set->name_lens[p]);
+			}
+		}
+	}
+
+	if (nmatches > 0) {
+		++(search->result.nrecords);
+		search->result.nmatches += nmatches;
+	}
+	return nmatches;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* one pattern per non-blank line, named by itself */
+static int read_pattern_lines (char *begin, char *end, struct record_list *list)
+{
+	char *line = begin;
+
+	while (line < end) {
+		char *eol = memchr(line, '\n', end - line);
+		if (eol == NULL) {
+			eol = end;
+		}
+
+		char *last = eol;
+		while (last > line && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) {
+			last--;
+		}
+
+		if (last > line) {
+			if (list->size == list->capacity) {
+				size_t capacity = (list->capacity == 0) ? 1024 : 2 * list->capacity;
+				struct gene_record *tmp = realloc(list->records, capacity * sizeof(*tmp));
+
+				if (tmp == NULL) {
+					return -1;
+				}
+				list->records = tmp;
+				list->capacity = capacity;
+			}
+
+			struct gene_record *rec = &list->records[list->size++];
+			rec->defline = rec->sequence = line;
+			rec->defline_len = rec->sequence_len = last - line;
+			rec->lazy = NULL;
+		}
+		line = eol + 1;
+	}
+	return 0;
+}
+
+/* insert PATTERN into the trie; the caller has made room for LEN new states */
+static void add_pattern (struct pattern_set *set, const char *pattern, size_t len, size_t id)
+{
+	uint32_t state = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		uint32_t *next = &set->delta[state * set->nclasses + set->classes[(unsigned char) pattern[i]]];
+
+		/* state 0 is the root, which is never a child, so 0 means no edge yet */
+		if (*next == 0) {
+			*next = set->nstates;
+			set->output[set->nstates] = -1;
+			++(set->nstates);
+		}
+		state = *next;
+	}
+
+	/* duplicates are chained, and all reported */
+	set->next_same[id] = set->output[state];
+	set->output[state] = id;
+}
+
+static int grow_states (struct pattern_set *set, size_t *capacity)
+{
+	size_t new_capacity = (*capacity == 0) ? 1024 : 2 * *capacity;
+
+	if (new_capacity > UINT32_MAX) {
+		fputs("error: too many patterns\n", stderr);
+		return -1;
+	}
+
+	uint32_t *delta = realloc(set->delta, new_capacity * set->nclasses * sizeof(*delta));
+	if (delta == NULL) {
+		return -1;
+	}
+	set->delta = delta;
+	memset(delta + *capacity * set->nclasses, 0,
+	       (new_capacity - *capacity) * set->nclasses * sizeof(*delta));
+
+	int32_t *output = realloc(set->output, new_capacity * sizeof(*output));
+	if (output == NULL) {
+		return -1;
+	}
+	set->output = output;
+
+	*capacity = new_capacity;
+	return 0;
+}
+
+/*
+ * Breadth-first over the trie, computing each state's failure link from
+ * its parent's. Missing edges are replaced by the failure state's edge,
+ * which is already complete since it is shallower, so afterwards DELTA
+ * is a full DFA and the failure links themselves can be dropped.
+ */
+static int link_states (struct pattern_set *set)
+{
+	const size_t nclasses = set->nclasses;
+	uint32_t *fail = malloc(set->nstates * sizeof(*fail));
+	uint32_t *queue = malloc(set->nstates * sizeof(*queue));
+
+	set->report = malloc(set->nstates * sizeof(*set->report));
+
+	if (fail == NULL || queue == NULL || set->report == NULL) {
+		free(fail);
+		free(queue);
+		return -1;
+	}
+
+	size_t head = 0;
+	size_t tail = 0;
+
+	fail[0] = 0;
+	set->report[0] = 0;
+	for (size_t c = 0; c < nclasses; c++) {
+		uint32_t child = set->delta[c];
+		if (child != 0) {
+			fail[child] = 0;
+			set->report[child] = 0;
+			queue[tail++] = child;
+		}
+	}
+
+	while (head < tail) {
+		uint32_t state = queue[head++];
+		uint32_t *edges = &set->delta[state * nclasses];
+		const uint32_t *fail_edges = &set->delta[fail[state] * nclasses];
+
+		for (size_t c = 0; c < nclasses; c++) {
+			uint32_t child = edges[c];
+
+			if (child == 0) {
+				edges[c] = fail_edges[c];
+				continue;
+			}
+
+			uint32_t f = fail_edges[c];
+			fail[child] = f;
+			set->report[child] = (set->output[f] >= 0) ? f : set->report[f];
+			queue[tail++] = child;
+		}
+	}
+
+	free(fail);
+	free(queue);
+	return 0;
+}
+
+static void write_match (struct search_out *out, size_t offset, const char *name, size_t len)
+{
+	search_out_write(out, "  ", 2);
+	search_out_number(out, offset);
+	search_out_write(out, ": ", 2);
+	search_out_write(out, name, len);
+	search_out_write(out, "\n", 1);
+}
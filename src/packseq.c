@@ -0,0 +1,226 @@
+/* packseq.c - pack nucleotide sequences at 2 bits per base */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <arena.h>
+#include <packseq.h>
+
+/* base_code[c] : 1-4 for ACGT, 5 for other IUPAC codes, 0 if not a nucleotide */
+#define CODE_OTHER 5
+
+static const uint8_t base_code[256] = {
+	['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+	['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4,
+
+	['U'] = CODE_OTHER, ['R'] = CODE_OTHER, ['Y'] = CODE_OTHER, ['S'] = CODE_OTHER,
+	['W'] = CODE_OTHER, ['K'] = CODE_OTHER, ['M'] = CODE_OTHER, ['B'] = CODE_OTHER,
+	['D'] = CODE_OTHER, ['H'] = CODE_OTHER, ['V'] = CODE_OTHER, ['N'] = CODE_OTHER,
+	['u'] = CODE_OTHER, ['r'] = CODE_OTHER, ['y'] = CODE_OTHER, ['s'] = CODE_OTHER,
+	['w'] = CODE_OTHER, ['k'] = CODE_OTHER, ['m'] = CODE_OTHER, ['b'] = CODE_OTHER,
+	['d'] = CODE_OTHER, ['h'] = CODE_OTHER, ['v'] = CODE_OTHER, ['n'] = CODE_OTHER,
+	['-'] = CODE_OTHER, ['*'] = CODE_OTHER,
+};
+
+/* decode_table[b] : the four bases packed into byte B */
+static char decode_table[256][4];
+static pthread_once_t decode_table_once = PTHREAD_ONCE_INIT;
+
+static void init_decode_table (void);
+static size_t first_run (const struct seq_run *runs, size_t nruns, size_t from);
+static int is_lower (char c);
+static char to_upper (char c);
+static char to_lower (char c);
+
+struct packed_seq *pack_sequence (struct arena *arena, const char *sequence, size_t len)
+{
+	size_t nexceptions = 0;
+	size_t nmasks = 0;
+
+	/* first pass: check the alphabet and count the runs we will need */
+	for (size_t i = 0; i < len; i++) {
+		uint8_t code = base_code[(unsigned char) sequence[i]];
+
+		if (code == 0) {
+			return NULL;
+		}
+		else if (code == CODE_OTHER &&
+			 (i == 0 || to_upper(sequence[i - 1]) != to_upper(sequence[i]))) {
+			++nexceptions;
+		}
+
+		if (is_lower(sequence[i]) && (i == 0 || !is_lower(sequence[i - 1]))) {
+			++nmasks;
+		}
+	}
+
+	size_t nbytes = (len + 3) / 4;
+	size_t runs_offset = (nbytes + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	size_t total = sizeof(struct packed_seq) + runs_offset
+		+ (nexceptions + nmasks) * sizeof(struct seq_run);
+
+	/* mostly ambiguity codes or masking changes: plain text is smaller */
+	if (total >= len) {
+		return NULL;
+	}
+
+	struct packed_seq *packed = arena_alloc(arena, total);
+	if (packed == NULL) {
+		return NULL;
+	}
+
+	packed->nexceptions = 0;
+	packed->nmasks = 0;
+	packed->exceptions = (struct seq_run *) (packed->bits + runs_offset);
+	packed->masks = packed->exceptions + nexceptions;
+	memset(packed->bits, 0, nbytes);
+
+	/* second pass: pack bases and record the runs */
+	for (size_t i = 0; i < len; i++) {
+		char c = sequence[i];
+		uint8_t code = base_code[(unsigned char) c];
+
+		if (code == CODE_OTHER) {
+			struct seq_run *run = (packed->nexceptions > 0) ?
+				&packed->exceptions[packed->nexceptions - 1] : NULL;
+
+			if (run != NULL && run->pos + run->len == i && run->base == to_upper(c)) {
+				++(run->len);
+			}
+			else {
+				run = &packed->exceptions[packed->nexceptions++];
+				run->pos = i;
+				run->len = 1;
+				run->base = to_upper(c);
+			}
+		}
+		else {
+			packed->bits[i / 4] |= (code - 1) << (2 * (i % 4));
+		}
+
+		if (is_lower(c)) {
+			struct seq_run *run = (packed->nmasks > 0) ?
+				&packed->masks[packed->nmasks - 1] : NULL;
+
+			if (run != NULL && run->pos + run->len == i) {
+				++(run->len);
+			}
+			else {
+				run = &packed->masks[packed->nmasks++];
+				run->pos = i;
+				run->len = 1;
+				run->base = 0;
+			}
+		}
+	}
+
+	return packed;
+}
+
+void unpack_sequence (const struct packed_seq *packed, size_t from, size_t count, char *out)
+{
+	pthread_once(&decode_table_once, &init_decode_table);
+
+	size_t i = 0;
+	size_t pos = from;
+
+	/* leading partial byte, then four bases per byte, then the tail */
+	for (; i < count && (pos % 4) != 0; i++, pos++) {
+		out[i] = decode_table[packed->bits[pos / 4]][pos % 4];
+	}
+	for (; count - i >= 4; i += 4, pos += 4) {
+		memcpy(out + i, decode_table[packed->bits[pos / 4]], 4);
+	}
+	for (; i < count; i++, pos++) {
+		out[i] = decode_table[packed->bits[pos / 4]][pos % 4];
+	}
+
+	size_t to = from + count;
+
+	/* runs are sorted and disjoint, so only a contiguous subset overlaps:
+	   find where it starts rather than passing every run before it */
+	for (size_t r = first_run(packed->exceptions, packed->nexceptions, from);
+	     r < packed->nexceptions; r++) {
+		const struct seq_run *run = &packed->exceptions[r];
+
+		if (run->pos >= to) {
+			break;
+		}
+		else if (run->pos + run->len <= from) {
+			continue;
+		}
+
+		size_t begin = (run->pos > from) ? run->pos : from;
+		size_t end = (run->pos + run->len < to) ? run->pos + run->len : to;
+		memset(out + (begin - from), run->base, end - begin);
+	}
+
+	for (size_t r = first_run(packed->masks, packed->nmasks, from); r < packed->nmasks; r++) {
+		const struct seq_run *run = &packed->masks[r];
+
+		if (run->pos >= to) {
+			break;
+		}
+		else if (run->pos + run->len <= from) {
+			continue;
+		}
+
+		size_t begin = (run->pos > from) ? run->pos : from;
+		size_t end = (run->pos + run->len < to) ? run->pos + run->len : to;
+		for (size_t j = begin; j < end; j++) {
+			out[j - from] = to_lower(out[j - from]);
+		}
+	}
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+static void init_decode_table (void)
+{
+	static const char bases[4] = { 'A', 'C', 'G', 'T' };
+
+	for (int b = 0; b < 256; b++) {
+		for (int j = 0; j < 4; j++) {
+			decode_table[b][j] = bases[(b >> (2 * j)) & 3];
+		}
+	}
+}
+
+/* index of the first of the NRUNS sorted, disjoint RUNS to end after FROM,
+   or NRUNS if none does */
+static size_t first_run (const struct seq_run *runs, size_t nruns, size_t from)
+{
+	size_t lo = 0, hi = nruns;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (runs[mid].pos + runs[mid].len <= from) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* locale-independent, since sequences are plain ASCII */
+static int is_lower (char c)
+{
+	return (c >= 'a' && c <= 'z');
+}
+
+static char to_upper (char c)
+{
+	return is_lower(c) ? c - ('a' - 'A') : c;
+}
+
+static char to_lower (char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
@@ -0,0 +1,229 @@
+/* parse.c - split FASTA input into defline/sequence records */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <parse.h>
+#include <scan.h>
+
+/* don't bother spawning a thread for less input than this */
+#define CHUNK_MIN (1 << 20)
+
+struct parse_job {
+	char *begin;
+	char *end;
+
+	struct record_list *list;
+	int status;
+};
+
+static int record_list_push (struct record_list *list, const char *defline, size_t defline_len,
+			     const char *sequence, size_t sequence_len);
+static char *next_record_start (char *begin, char *pos, char *end);
+static void *parse_job_run (void *arg);
+
+int parse_records (char *begin, char *end, struct record_list *list)
+{
+	struct line_scanner scanner;
+	char *curr = begin;
+
+	line_scanner_init(&scanner, begin, end);
+
+	/* Step down through input, emitting a record for each header and the
+	   sequence lines that follow it. */
+
+	while (curr < end) {
+		char *eol = (char *) line_scanner_next(&scanner);
+
+		if (*curr != '>') {
+			fprintf(stderr, "parse error: sequence found before first description line\n");
+			return -1;
+		}
+
+		const char *defline = curr + 1;
+		size_t defline_len = eol - defline;
+
+		/* Join wrapped sequence lines in place. The joined sequence is never
+		   longer than the lines it came from, so it fits where they were, and
+		   everything past the current line is left untouched for the scanner. */
+		char *sequence = eol + 1;
+		char *dest = sequence;
+		size_t nlines = 0;
+
+		curr = eol + 1;
+		while (curr < end && *curr != '>') {
+			eol = (char *) line_scanner_next(&scanner);
+
+			if (dest != curr) {
+				memmove(dest, curr, eol - curr);
+			}
+			dest += eol - curr;
+			++nlines;
+
+			curr = eol + 1;
+		}
+
+		/* as before, a header with no sequence lines doesn't make a record */
+		if (nlines > 0 &&
+		    record_list_push(list, defline, defline_len, sequence, dest - sequence) == -1) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+long parse_records_parallel (char *begin, char *end, size_t nthreads,
+			     struct record_list **lists)
+{
+	size_t len = end - begin;
+
+	if (nthreads == 0) {
+		nthreads = 1;
+	}
+	if (len / nthreads < CHUNK_MIN) {
+		nthreads = len / CHUNK_MIN + 1;
+	}
+
+	struct parse_job *jobs = calloc(nthreads, sizeof(*jobs));
+	pthread_t *threads = calloc(nthreads, sizeof(*threads));
+	*lists = calloc(nthreads, sizeof(**lists));
+
+	if (jobs == NULL || threads == NULL || *lists == NULL) {
+		free(jobs);
+		free(threads);
+		free(*lists);
+		*lists = NULL;
+		return -1;
+	}
+
+	/* cut the input into roughly equal ranges, each moved forward to start on a '>' */
+	char *chunk_begin = begin;
+	size_t njobs = 0;
+
+	for (size_t i = 0; i < nthreads && chunk_begin < end; i++) {
+		char *chunk_end = end;
+
+		if (i + 1 < nthreads) {
+			chunk_end = next_record_start(begin, begin + (len / nthreads) * (i + 1), end);
+		}
+		if (chunk_end <= chunk_begin) {
+			continue;
+		}
+
+		jobs[njobs].begin = chunk_begin;
+		jobs[njobs].end = chunk_end;
+		jobs[njobs].list = &(*lists)[njobs];
+		++njobs;
+
+		chunk_begin = chunk_end;
+	}
+
+	/* first chunk runs on this thread; fall back to it if a thread can't be started */
+	size_t nstarted = 1;
+	for (size_t i = 1; i < njobs; i++) {
+		if (pthread_create(&threads[i], NULL, &parse_job_run, &jobs[i]) != 0) {
+			break;
+		}
+		++nstarted;
+	}
+
+	for (size_t i = 0; i < njobs; i++) {
+		if (i == 0 || i >= nstarted) {
+			parse_job_run(&jobs[i]);
+		}
+	}
+	for (size_t i = 1; i < nstarted; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	int status = 0;
+	for (size_t i = 0; i < njobs; i++) {
+		if (jobs[i].status == -1) {
+			status = -1;
+		}
+	}
+
+	free(jobs);
+	free(threads);
+
+	if (status == -1) {
+		free_record_lists(*lists, nthreads);
+		*lists = NULL;
+		return -1;
+	}
+	return njobs;
+}
+
+void free_record_lists (struct record_list *lists, size_t nlists)
+{
+	if (lists != NULL) {
+		for (size_t i = 0; i < nlists; i++) {
+			free(lists[i].records);
+			lists[i].records = NULL;
+		}
+	}
+	free(lists);
+}
+
+size_t default_thread_count (void)
+{
+	long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (nprocs > 0) ? (size_t) nprocs : 1;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+static int record_list_push (struct record_list *list, const char *defline, size_t defline_len,
+			     const char *sequence, size_t sequence_len)
+{
+	if (list->size == list->capacity) {
+		size_t capacity = (list->capacity == 0) ? 1024 : 2 * list->capacity;
+
+		/* need a temporary buffer, since realloc leaves the list unchanged on failure */
+		struct gene_record *tmp = realloc(list->records, capacity * sizeof(*tmp));
+		if (tmp == NULL) {
+			return -1;
+		}
+		list->records = tmp;
+		list->capacity = capacity;
+	}
+
+	struct gene_record *rec = &list->records[list->size++];
+	rec->defline = defline;
+	rec->defline_len = defline_len;
+	rec->sequence = sequence;
+	rec->sequence_len = sequence_len;
+	rec->lazy = NULL;
+
+	return 0;
+}
+
+/* Return the first position at or after POS that begins a defline, or END. */
+static char *next_record_start (char *begin, char *pos, char *end)
+{
+	if (pos <= begin) {
+		return begin;
+	}
+	else if (pos >= end) {
+		return end;
+	}
+
+	/* a defline at POS itself is preceded by the newline at POS - 1 */
+	return (char *) scan_record_start(pos - 1, end);
+}
+
+static void *parse_job_run (void *arg)
+{
+	struct parse_job *job = arg;
+
+	job->status = parse_records(job->begin, job->end, job->list);
+	return NULL;
+}
@@ -0,0 +1,173 @@
+/* region.c - parse and print subsequences of records */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <genetree.h>
+#include <region.h>
+#include <strand.h>
+
+static const char *parse_position (const char *p, size_t *value);
+static int parse_range (const char *p, struct region *region);
+
+int region_parse (const char *string, struct region *region)
+{
+	const char *colon = strrchr(string, ':');
+
+	region->id = string;
+	region->id_len = strlen(string);
+	region->start = 0;
+	region->end = REGION_END;
+	region->reverse = 0;
+
+	/* a colon followed by anything but digits, commas and a dash is part
+	   of the ID; otherwise what follows must be a valid range */
+	if (colon != NULL && colon[1 + strspn(colon + 1, "0123456789,-")] == '\0') {
+		if (parse_range(colon + 1, region) == -1) {
+			return -1;
+		}
+		region->id_len = colon - string;
+	}
+	return (region->id_len > 0) ? 0 : -1;
+}
+
+int region_parse_bed (const char *line, struct region *region)
+{
+	const char *p = line;
+	size_t field_len[6] = {0};
+	const char *field[6] = {NULL};
+	size_t nfields = 0;
+
+	if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#' ||
+	    !strncmp(line, "track", 5) || !strncmp(line, "browser", 7)) {
+		return 1;
+	}
+
+	while (nfields < 6) {
+		field[nfields] = p;
+		field_len[nfields] = strcspn(p, "\t\r\n");
+		p += field_len[nfields++];
+		if (*p != '\t') {
+			break;
+		}
+		++p;
+	}
+
+	const char *end;
+
+	if (nfields < 3 || field_len[0] == 0 ||
+	    (end = parse_position(field[1], &region->start)) != field[1] + field_len[1] || end == field[1] ||
+	    (end = parse_position(field[2], &region->end)) != field[2] + field_len[2] || end == field[2] ||
+	    region->end < region->start) {
+		return -1;
+	}
+
+	region->id = field[0];
+	region->id_len = field_len[0];
+	region->reverse = (nfields == 6 && field_len[5] == 1 && field[5][0] == '-');
+	return 0;
+}
+
+int region_print (const struct region *region, const struct gene_node *node, FILE *stream)
+{
+	size_t start = region->start;
+	size_t end = (region->end < node->sequence_len) ? region->end : node->sequence_len;
+
+	if (start > node->sequence_len || (start == node->sequence_len && start > 0)) {
+		fprintf(stderr, "%.*s:%lu: beyond end of sequence (%lu bases)\n",
+			(int) region->id_len, region->id, start + 1, node->sequence_len);
+		return -1;
+	}
+
+	fputc('>', stream);
+	fwrite(region->id, 1, region->id_len, stream);
+	if (start > 0 || region->end != REGION_END) {
+		fprintf(stream, ":%lu-%lu", start + 1, end);
+	}
+	fputs(region->reverse ? "/rc\n" : "\n", stream);
+
+	/* forwards from START, or backwards from END for the reverse strand,
+	   a chunk at a time, so a region of any size costs a bounded buffer */
+	size_t len = end - start;
+	char *revcomp = NULL;
+
+	if (region->reverse && len > 0 &&
+	    (revcomp = malloc((len < REGION_CHUNK) ? len : REGION_CHUNK)) == NULL) {
+		fputc('\n', stream);
+		fprintf(stderr, "error: out of memory\n");
+		return -1;
+	}
+
+	for (size_t done = 0; done < len; ) {
+		size_t count = (len - done < REGION_CHUNK) ? len - done : REGION_CHUNK;
+		const char *bases = gene_node_window(node, region->reverse ? end - done - count : start + done, count);
+
+		if (bases == NULL) {
+			fputc('\n', stream);
+			fprintf(stderr, "error: unable to read sequence of %.*s\n",
+				(int) node->defline_len, node->defline);
+			free(revcomp);
+			return -1;
+		}
+		if (region->reverse) {
+			reverse_complement(revcomp, bases, count);
+			bases = revcomp;
+		}
+		fwrite(bases, 1, count, stream);
+		done += count;
+	}
+	fputc('\n', stream);
+	free(revcomp);
+	return 0;
+}
+
+/* STATIC FUNCTION DEFINITIONS */
+
+/* Read a base position at P into *VALUE, skipping commas. Return a pointer
+   past it, or P itself if there are no digits or the value overflows. */
+static const char *parse_position (const char *p, size_t *value)
+{
+	const char *start = p;
+	size_t digits = 0;
+
+	*value = 0;
+	for (; (*p >= '0' && *p <= '9') || (*p == ',' && digits > 0); p++) {
+		if (*p == ',') {
+			continue;
+		}
+		if (*value > (REGION_END - 9) / 10) {
+			return start;
+		}
+		*value = *value * 10 + (*p - '0');
+		++digits;
+	}
+	return (digits > 0) ? p : start;
+}
+
+/* Parse P as START or START-END, 1-based and inclusive, into REGION.
+   Return 0 on success, -1 if P isn't a range. */
+static int parse_range (const char *p, struct region *region)
+{
+	size_t start;
+	size_t end = REGION_END;
+	const char *q = parse_position(p, &start);
+
+	if (q == p || start == 0) {
+		return -1;
+	}
+	if (*q == '-') {
+		const char *r = q + 1;
+
+		if ((q = parse_position(r, &end)) == r || end < start) {
+			return -1;
+		}
+	}
+	if (*q != '\0') {
+		return -1;
+	}
+
+	region->start = start - 1;
+	region->end = end;
+	return 0;
+}
@@ -0,0 +1,164 @@
+/* scan.c - vectorised search for newlines and record starts */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#include <scan.h>
+
+#define BLOCK 64
+
+static uint64_t eq_mask64_scalar (const char *p, char c);
+static uint64_t eq_mask_tail (const char *p, size_t len, char c);
+
+#ifdef SCAN_X86
+static uint64_t eq_mask64_sse2 (const char *p, char c);
+static uint64_t eq_mask64_avx2 (const char *p, char c);
+#endif
+
+/* resolved on first use to the widest kernel the CPU supports */
+static uint64_t (*eq_mask64)(const char *, char) = NULL;
+static pthread_once_t eq_mask64_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel (void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		eq_mask64 = &eq_mask64_avx2;
+		return;
+	}
+	else if (__builtin_cpu_supports("sse2")) {
+		eq_mask64 = &eq_mask64_sse2;
+		return;
+	}
+#endif
+	eq_mask64 = &eq_mask64_scalar;
+}
+
+uint64_t scan_eq_mask64 (const char *p, char c)
+{
+	pthread_once(&eq_mask64_once, &select_kernel);
+
+	return (*eq_mask64)(p, c);
+}
+
+void line_scanner_init (struct line_scanner *scanner, const char *begin, const char *end)
+{
+	scanner->block = begin;
+	scanner->end = end;
+
+	if (end - begin >= BLOCK) {
+		scanner->mask = scan_eq_mask64(begin, '\n');
+	}
+	else {
+		scanner->mask = eq_mask_tail(begin, end - begin, '\n');
+	}
+}
+
+const char *line_scanner_next (struct line_scanner *scanner)
+{
+	while (scanner->mask == 0) {
+		if (scanner->end - scanner->block <= BLOCK) {
+			scanner->block = scanner->end;
+			return scanner->end;
+		}
+
+		scanner->block += BLOCK;
+
+		if (scanner->end - scanner->block >= BLOCK) {
+			scanner->mask = scan_eq_mask64(scanner->block, '\n');
+		}
+		else {
+			scanner->mask = eq_mask_tail(scanner->block, scanner->end - scanner->block, '\n');
+		}
+	}
+
+	const char *newline = scanner->block + __builtin_ctzll(scanner->mask);
+	scanner->mask &= scanner->mask - 1; /* clear lowest set bit */
+
+	return newline;
+}
+
+const char *scan_record_start (const char *begin, const char *end)
+{
+	const char *p = begin;
+	uint64_t carry = 0; /* newline in last byte of previous block */
+
+	for (; end - p >= BLOCK; p += BLOCK) {
+		uint64_t newlines = scan_eq_mask64(p, '\n');
+		uint64_t starts = ((newlines << 1) | carry) & scan_eq_mask64(p, '>');
+
+		if (starts != 0) {
+			return p + __builtin_ctzll(starts);
+		}
+		carry = newlines >> 63;
+	}
+
+	for (; p < end; p++) {
+		if (*p == '>' && carry) {
+			return p;
+		}
+		carry = (*p == '\n');
+	}
+
+	return end;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+static uint64_t eq_mask64_scalar (const char *p, char c)
+{
+	return eq_mask_tail(p, BLOCK, c);
+}
+
+static uint64_t eq_mask_tail (const char *p, size_t len, char c)
+{
+	uint64_t mask = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		mask |= (uint64_t) (p[i] == c) << i;
+	}
+	return mask;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static uint64_t eq_mask64_sse2 (const char *p, char c)
+{
+	__m128i needle = _mm_set1_epi8(c);
+	uint64_t mask = 0;
+
+	for (int i = 0; i < BLOCK; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) (p + i));
+		uint64_t bits = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+
+		mask |= bits << i;
+	}
+	return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t eq_mask64_avx2 (const char *p, char c)
+{
+	__m256i needle = _mm256_set1_epi8(c);
+
+	__m256i lo = _mm256_loadu_si256((const __m256i *) p);
+	__m256i hi = _mm256_loadu_si256((const __m256i *) (p + 32));
+
+	uint64_t mask_lo = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle));
+	uint64_t mask_hi = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle));
+
+	return (mask_hi << 32) | mask_lo;
+}
+
+#endif /* SCAN_X86 */
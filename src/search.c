@@ -0,0 +1,308 @@
+/* search.c - vectorised substring search and buffered match output */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SEARCH_X86
+#include <immintrin.h>
+#endif
+
+#include <genetree.h>
+#include <search.h>
+
+/* bytes of sequence either side of a match to show */
+#define CONTEXT 30
+
+#define HIGHLIGHT_ON "\033[0;31m"
+#define HIGHLIGHT_OFF "\033[0m"
+
+static size_t find_scalar (const char *haystack, size_t haystack_len,
+			   const char *needle, size_t needle_len, size_t from);
+
+#ifdef SEARCH_X86
+static size_t find_sse2 (const char *haystack, size_t haystack_len,
+			 const char *needle, size_t needle_len, size_t from);
+static size_t find_avx2 (const char *haystack, size_t haystack_len,
+			 const char *needle, size_t needle_len, size_t from);
+#endif
+
+/* resolved on first use to the widest kernel the CPU supports */
+static size_t (*find_kernel)(const char *, size_t, const char *, size_t, size_t) = NULL;
+static pthread_once_t find_kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel (void)
+{
+#ifdef SEARCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		find_kernel = &find_avx2;
+		return;
+	}
+	else if (__builtin_cpu_supports("sse2")) {
+		find_kernel = &find_sse2;
+		return;
+	}
+#endif
+	find_kernel = &find_scalar;
+}
+
+size_t find_substring (const char *haystack, size_t haystack_len,
+		       const char *needle, size_t needle_len, size_t from)
+{
+	if (needle_len == 0 || from > haystack_len || haystack_len - from < needle_len) {
+		return NO_MATCH;
+	}
+	else if (needle_len == 1) {
+		const char *match = memchr(haystack + from, needle[0], haystack_len - from);
+		return (match == NULL) ? NO_MATCH : (size_t) (match - haystack);
+	}
+
+	pthread_once(&find_kernel_once, &select_kernel);
+	return (*find_kernel)(haystack, haystack_len, needle, needle_len, from);
+}
+
+int search_defline (const struct gene_node *node, void *arg)
+{
+	struct substring_search *search = arg;
+	struct search_out *out = search->result.out;
+	size_t len = search->pattern_len;
+	size_t printed = 0;
+	int nmatches = 0;
+
+	/* one line per defline, with every occurrence highlighted */
+	for (size_t at = find_substring(node->defline, node->defline_len, search->pattern, len, 0);
+	     at != NO_MATCH;
+	     at = find_substring(node->defline, node->defline_len, search->pattern, len, at + 1)) {
+
+		if (nmatches++ == 0) {
+			search_out_write(out, "Match found:\n", 13);
+		}
+		/* overlapping matches are counted, but only highlighted once */
+		if (at >= printed) {
+			search_out_write(out, node->defline + printed, at - printed);
+			search_out_write(out, HIGHLIGHT_ON, sizeof(HIGHLIGHT_ON) - 1);
+			search_out_write(out, node->defline + at, len);
+			search_out_write(out, HIGHLIGHT_OFF, sizeof(HIGHLIGHT_OFF) - 1);
+			printed = at + len;
+		}
+	}
+
+	if (nmatches > 0) {
+		search_out_write(out, node->defline + printed, node->defline_len - printed);
+		search_out_write(out, "\n", 1);
+
+		++(search->result.nrecords);
+		search->result.nmatches += nmatches;
+	}
+	return nmatches;
+}
+
+int search_sequence (const struct gene_node *node, void *arg)
+{
+	struct substring_search *search = arg;
+	struct search_out *out = search->result.out;
+	const char *sequence = gene_node_sequence(node);
+	size_t seq_len = node->sequence_len;
+	size_t len = search->pattern_len;
+	int nmatches = 0;
+
+	if (sequence == NULL) {
+		fprintf(stderr, "error: unable to read sequence of %.*s\n",
+			(int) node->defline_len, node->defline);
+		return -1;
+	}
+
+	/* defline once, then one line per occurrence: offset and context */
+	for (size_t at = find_substring(sequence, seq_len, search->pattern, len, 0);
+	     at != NO_MATCH;
+	     at = find_substring(sequence, seq_len, search->pattern, len, at + 1)) {
+
+		if (nmatches++ == 0) {
+			search_write_record(out, node);
+		}
+
+		size_t begin, end;
+		search_context(seq_len, at, len, &begin, &end);
+		search_write_match(out, sequence + begin, begin, end, seq_len, at, len, NULL);
+	}
+
+	if (nmatches > 0) {
+		++(search->result.nrecords);
+		search->result.nmatches += nmatches;
+	}
+	return nmatches;
+}
+
+void search_write_record (struct search_out *out, const struct gene_node *node)
+{
+	search_out_write(out, "Match found: >", 14);
+	search_out_write(out, node->defline, node->defline_len);
+	search_out_write(out, "\n", 1);
+}
+
+void search_context (size_t seq_len, size_t at, size_t len, size_t *begin, size_t *end)
+{
+	*begin = (at > CONTEXT) ? at - CONTEXT : 0;
+	*end = (seq_len - (at + len) > CONTEXT) ? at + len + CONTEXT : seq_len;
+}
+
+void search_write_match (struct search_out *out, const char *context, size_t begin, size_t end,
+			 size_t seq_len, size_t at, size_t len, const char *note)
+{
+	const char *match = context + (at - begin);
+
+	search_out_write(out, "  ", 2);
+	search_out_number(out, at);
+	search_out_write(out, ": ", 2);
+	if (begin > 0) {
+		search_out_write(out, "...", 3);
+	}
+	search_out_write(out, context, at - begin);
+	search_out_write(out, HIGHLIGHT_ON, sizeof(HIGHLIGHT_ON) - 1);
+	search_out_write(out, match, len);
+	search_out_write(out, HIGHLIGHT_OFF, sizeof(HIGHLIGHT_OFF) - 1);
+	search_out_write(out, match + len, end - (at + len));
+	if (end < seq_len) {
+		search_out_write(out, "...", 3);
+	}
+	if (note != NULL) {
+		search_out_write(out, " ", 1);
+		search_out_write(out, note, strlen(note));
+	}
+	search_out_write(out, "\n", 1);
+}
+
+void search_out_init (struct search_out *out, FILE *stream)
+{
+	out->stream = stream;
+	out->len = 0;
+}
+
+void search_out_write (struct search_out *out, const char *data, size_t len)
+{
+	if (out->len + len > SEARCH_OUT_SIZE) {
+		search_out_flush(out);
+
+		/* too big to be worth buffering */
+		if (len > SEARCH_OUT_SIZE) {
+			fwrite(data, 1, len, out->stream);
+			return;
+		}
+	}
+
+	memcpy(out->buf + out->len, data, len);
+	out->len += len;
+}
+
+void search_out_number (struct search_out *out, size_t n)
+{
+	char digits[24];
+	size_t i = sizeof(digits);
+
+	do {
+		digits[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n != 0);
+
+	search_out_write(out, digits + i, sizeof(digits) - i);
+}
+
+void search_out_flush (struct search_out *out)
+{
+	if (out->len > 0) {
+		fwrite(out->buf, 1, out->len, out->stream);
+		out->len = 0;
+	}
+	fflush(out->stream);
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/*
+ * Matching kernels.
+ *
+ * All of these expect 2 <= NEEDLE_LEN <= HAYSTACK_LEN - FROM. The vector
+ * versions compare a block of candidate positions at once against the
+ * first and last bytes of the needle, and only verify the middle with
+ * memcmp() where both agree; on sequence data this rejects almost every
+ * position without a branch. Positions too near the end for a full
+ * block are left to the scalar kernel.
+ */
+
+static size_t find_scalar (const char *haystack, size_t haystack_len,
+			   const char *needle, size_t needle_len, size_t from)
+{
+	const char first = needle[0];
+	const char last = needle[needle_len - 1];
+
+	for (size_t i = from; i + needle_len <= haystack_len; i++) {
+		if (haystack[i] == first && haystack[i + needle_len - 1] == last &&
+		    memcmp(haystack + i + 1, needle + 1, needle_len - 2) == 0) {
+			return i;
+		}
+	}
+	return NO_MATCH;
+}
+
+#ifdef SEARCH_X86
+
+__attribute__((target("sse2")))
+static size_t find_sse2 (const char *haystack, size_t haystack_len,
+			 const char *needle, size_t needle_len, size_t from)
+{
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+	size_t i = from;
+
+	for (; i + needle_len - 1 + 16 <= haystack_len; i += 16) {
+		__m128i block_first = _mm_loadu_si128((const __m128i *) (haystack + i));
+		__m128i block_last = _mm_loadu_si128((const __m128i *) (haystack + i + needle_len - 1));
+
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+								 _mm_cmpeq_epi8(block_last, last)));
+		while (mask != 0) {
+			size_t at = i + __builtin_ctz(mask);
+
+			if (memcmp(haystack + at + 1, needle + 1, needle_len - 2) == 0) {
+				return at;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	return find_scalar(haystack, haystack_len, needle, needle_len, i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2 (const char *haystack, size_t haystack_len,
+			 const char *needle, size_t needle_len, size_t from)
+{
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+	size_t i = from;
+
+	for (; i + needle_len - 1 + 32 <= haystack_len; i += 32) {
+		__m256i block_first = _mm256_loadu_si256((const __m256i *) (haystack + i));
+		__m256i block_last = _mm256_loadu_si256((const __m256i *) (haystack + i + needle_len - 1));
+
+		unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+								       _mm256_cmpeq_epi8(block_last, last)));
+		while (mask != 0) {
+			size_t at = i + __builtin_ctz(mask);
+
+			if (memcmp(haystack + at + 1, needle + 1, needle_len - 2) == 0) {
+				return at;
+			}
+			mask &= mask - 1;
+		}
+	}
+
+	return find_sse2(haystack, haystack_len, needle, needle_len, i);
+}
+
+#endif /* SEARCH_X86 */
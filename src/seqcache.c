@@ -0,0 +1,257 @@
+/* seqcache.c - LRU cache of lazily read sequences, within a byte limit */
+
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include <genetree.h>
+#include <seqcache.h>
+
+/* one cached sequence; LAZY is NULL once it has been dropped or evicted,
+   and it is freed when the last thread using it lets go */
+struct seq_cache_entry {
+	struct lazy_seq *lazy;
+	int fd;
+
+	char *bases;
+	size_t len;
+	unsigned pins;
+
+	/* least recently used list, most recent first */
+	struct seq_cache_entry *prev;
+	struct seq_cache_entry *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct seq_cache_stats stats;
+
+	struct seq_cache_entry *head;
+	struct seq_cache_entry *tail;
+} cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* per thread, the entry holding the bases it was last given */
+static pthread_key_t pin_key;
+static pthread_once_t pin_once = PTHREAD_ONCE_INIT;
+
+static void init_pin_key (void);
+static void pin (struct seq_cache_entry *entry);
+static void unpin (void *entry);
+static struct seq_cache_entry *load_entry (struct lazy_seq *lazy, size_t len);
+static void insert (struct seq_cache_entry *entry);
+static void detach (struct seq_cache_entry *entry);
+static void evict (size_t limit);
+
+void seq_cache_set_limit (size_t limit)
+{
+	pthread_mutex_lock(&cache.lock);
+	cache.stats.limit = limit;
+	evict(limit);
+	pthread_mutex_unlock(&cache.lock);
+}
+
+const char *seq_cache_get (struct lazy_seq *lazy, size_t len, int load)
+{
+	struct seq_cache_entry *entry;
+
+	pthread_mutex_lock(&cache.lock);
+	if (cache.stats.limit == 0) {
+		pthread_mutex_unlock(&cache.lock);
+		return NULL;
+	}
+	else if ((entry = lazy->cached) != NULL) {
+		++cache.stats.hits;
+		detach(entry);
+		insert(entry);
+		++entry->pins;
+		pthread_mutex_unlock(&cache.lock);
+
+		pin(entry);
+		return entry->bases;
+	}
+
+	++cache.stats.misses;
+	size_t share = cache.stats.limit / SEQ_CACHE_SHARE;
+	pthread_mutex_unlock(&cache.lock);
+
+	if (!load || len > share || (entry = load_entry(lazy, len)) == NULL) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	if (lazy->cached != NULL) {
+		/* another thread read it first: use theirs */
+		free(entry->bases);
+		free(entry);
+		entry = lazy->cached;
+		detach(entry);
+	}
+	else {
+		cache.stats.used += entry->len;
+		++cache.stats.entries;
+		lazy->cached = entry;
+	}
+	insert(entry);
+	++entry->pins;
+	evict(cache.stats.limit);
+	pthread_mutex_unlock(&cache.lock);
+
+	pin(entry);
+	return entry->bases;
+}
+
+void seq_cache_drop (int fd)
+{
+	pthread_mutex_lock(&cache.lock);
+
+	struct seq_cache_entry *entry = cache.head;
+
+	while (entry != NULL) {
+		struct seq_cache_entry *next = entry->next;
+
+		if (entry->fd == fd) {
+			detach(entry);
+			entry->lazy->cached = NULL;
+			entry->lazy = NULL;
+			cache.stats.used -= entry->len;
+			--cache.stats.entries;
+
+			if (entry->pins == 0) {
+				free(entry->bases);
+				free(entry);
+			}
+		}
+		entry = next;
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void seq_cache_stats (struct seq_cache_stats *stats)
+{
+	pthread_mutex_lock(&cache.lock);
+	*stats = cache.stats;
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* STATIC FUNCTION DEFINITIONS */
+
+static void init_pin_key (void)
+{
+	pthread_key_create(&pin_key, &unpin);
+}
+
+/* Make ENTRY, already counted in its pins, this thread's pinned entry,
+   letting go of the one before. */
+static void pin (struct seq_cache_entry *entry)
+{
+	pthread_once(&pin_once, &init_pin_key);
+
+	struct seq_cache_entry *old = pthread_getspecific(pin_key);
+
+	pthread_setspecific(pin_key, entry);
+	if (old != NULL) {
+		unpin(old);
+	}
+}
+
+/* Let go of ENTRY, freeing it if it has left the cache and no thread is
+   using it, or evicting it if it was only kept for this thread. */
+static void unpin (void *ptr)
+{
+	struct seq_cache_entry *entry = ptr;
+
+	pthread_mutex_lock(&cache.lock);
+	if (--entry->pins == 0 && entry->lazy == NULL) {
+		free(entry->bases);
+		free(entry);
+	}
+	else {
+		evict(cache.stats.limit);
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* Read the whole LEN-base sequence at LAZY into a new entry, not yet in
+   the cache. Return NULL on failure. */
+static struct seq_cache_entry *load_entry (struct lazy_seq *lazy, size_t len)
+{
+	struct seq_cache_entry *entry = malloc(sizeof(*entry));
+	size_t span = lazy_seq_span(lazy, 0, len);
+	char *bases = malloc(span ? span : 1);
+
+	if (entry == NULL || bases == NULL || lazy_seq_read(lazy, 0, len, bases) == -1) {
+		free(entry);
+		free(bases);
+		return NULL;
+	}
+
+	/* line ends take up room only until they are closed up */
+	if (span > len) {
+		char *tmp = realloc(bases, len ? len : 1);
+		bases = (tmp != NULL) ? tmp : bases;
+	}
+
+	entry->lazy = lazy;
+	entry->fd = lazy->fd;
+	entry->bases = bases;
+	entry->len = len;
+	entry->pins = 0;
+	entry->prev = entry->next = NULL;
+	return entry;
+}
+
+/* put ENTRY at the head of the list */
+static void insert (struct seq_cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache.head;
+	if (cache.head != NULL) {
+		cache.head->prev = entry;
+	}
+	else {
+		cache.tail = entry;
+	}
+	cache.head = entry;
+}
+
+/* take ENTRY out of the list */
+static void detach (struct seq_cache_entry *entry)
+{
+	if (entry->prev != NULL) {
+		entry->prev->next = entry->next;
+	}
+	else {
+		cache.head = entry->next;
+	}
+	if (entry->next != NULL) {
+		entry->next->prev = entry->prev;
+	}
+	else {
+		cache.tail = entry->prev;
+	}
+	entry->prev = entry->next = NULL;
+}
+
+/* Evict least recently used entries that no thread is using until no more
+   than LIMIT bytes are held, or only pinned entries are left. */
+static void evict (size_t limit)
+{
+	struct seq_cache_entry *entry = cache.tail;
+
+	while (cache.stats.used > limit && entry != NULL) {
+		struct seq_cache_entry *prev = entry->prev;
+
+		if (entry->pins == 0) {
+			detach(entry);
+			entry->lazy->cached = NULL;
+			cache.stats.used -= entry->len;
+			--cache.stats.entries;
+			++cache.stats.evictions;
+			free(entry->bases);
+			free(entry);
+		}
+		entry = prev;
+	}
+}
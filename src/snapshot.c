@@ -0,0 +1,249 @@
+/* snapshot.c - save gene_trees in binary and map them back without parsing */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include <genetree.h>
+#include <mapfile.h>
+#include <parse.h>
+#include <snapshot.h>
+#include <treeops.h>
+
+/* stdio buffer for writing snapshots */
+#define SNAPSHOT_BUF_SIZE (1 << 22)
+
+static int write_record (FILE *stream, const struct gene_node *node, uint64_t *offset);
+static int read_index (const struct gene_map *map, uint64_t index_offset,
+		       struct gene_record *records, size_t n);
+
+long snapshot_save (const struct gene_tree *tree, const char *filename)
+{
+	/* written beside FILENAME and renamed over it, so that saving over a
+	   loaded snapshot never truncates a file still mapped */
+	size_t name_len = strlen(filename);
+	char *tmpname = malloc(name_len + sizeof(".tmp"));
+	uint64_t *index = malloc((tree->size + 1) * sizeof(*index));
+	struct tree_cursor cursor;
+
+	if (tmpname == NULL || index == NULL || cursor_init(&cursor, tree) == -1) {
+		free(tmpname);
+		free(index);
+		return -1;
+	}
+	memcpy(tmpname, filename, name_len);
+	memcpy(tmpname + name_len, ".tmp", sizeof(".tmp"));
+
+	FILE *stream = fopen(tmpname, "wb");
+	if (stream == NULL) {
+		fprintf(stderr, "unable to open file %s: %s\n", tmpname, strerror(errno));
+		cursor_free(&cursor);
+		free(tmpname);
+		free(index);
+		return -1;
+	}
+	setvbuf(stream, NULL, _IOFBF, SNAPSHOT_BUF_SIZE);
+
+	struct snapshot_header header;
+	struct snapshot_trailer trailer;
+	struct gene_node *node;
+	uint64_t offset = sizeof(header);
+	size_t n = 0;
+	int status = 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.nrecords = tree->size;
+
+	if (fwrite(&header, sizeof(header), 1, stream) != 1) {
+		status = -1;
+	}
+	while (status == 0 && (node = cursor_next(&cursor)) != NULL) {
+		index[n++] = offset;
+		status = write_record(stream, node, &offset);
+	}
+
+	memset(&trailer, 0, sizeof(trailer));
+	memcpy(trailer.magic, SNAPSHOT_MAGIC, sizeof(trailer.magic));
+	trailer.index_offset = offset;
+	trailer.nrecords = n;
+
+	if (status == 0 &&
+	    (fwrite(index, sizeof(*index), n, stream) != n ||
+	     fwrite(&trailer, sizeof(trailer), 1, stream) != 1)) {
+		status = -1;
+	}
+	if (fclose(stream) != 0 || status == -1) {
+		fprintf(stderr, "unable to write file %s\n", tmpname);
+		status = -1;
+	}
+	else if (rename(tmpname, filename) == -1) {
+		fprintf(stderr, "unable to replace %s: %s\n", filename, strerror(errno));
+		status = -1;
+	}
+	if (status == -1) {
+		remove(tmpname);
+	}
+
+	cursor_free(&cursor);
+	free(tmpname);
+	free(index);
+	return (status == 0) ? (long) n : -1;
+}
+
+int snapshot_load (struct gene_tree *tree, const char *filename)
+{
+	struct snapshot_header header;
+	struct snapshot_trailer trailer;
+	struct gene_map *map = map_file(filename);
+
+	if (map == NULL) {
+		return -1;
+	}
+	else if (map->len < sizeof(header) + sizeof(trailer)) {
+		fprintf(stderr, "%s is not a snapshot\n", filename);
+		unmap_file(map);
+		return -1;
+	}
+
+	memcpy(&header, map->addr, sizeof(header));
+	memcpy(&trailer, map->addr + map->len - sizeof(trailer), sizeof(trailer));
+
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+	    memcmp(trailer.magic, SNAPSHOT_MAGIC, sizeof(trailer.magic)) != 0) {
+		fprintf(stderr, "%s is not a snapshot\n", filename);
+		unmap_file(map);
+		return -1;
+	}
+	else if (header.version != SNAPSHOT_VERSION) {
+		fprintf(stderr, "%s is a version %u snapshot: this is version %d\n",
+			filename, header.version, SNAPSHOT_VERSION);
+		unmap_file(map);
+		return -1;
+	}
+
+	size_t n = header.nrecords;
+
+	/* the index runs from INDEX_OFFSET right up to the trailer */
+	if (trailer.nrecords != n || trailer.index_offset < sizeof(header) ||
+	    n > (map->len - sizeof(trailer)) / sizeof(uint64_t) ||
+	    trailer.index_offset != map->len - sizeof(trailer) - n * sizeof(uint64_t)) {
+		fprintf(stderr, "%s is corrupt\n", filename);
+		unmap_file(map);
+		return -1;
+	}
+
+	struct gene_record *records = malloc(n * sizeof(*records) + 1);
+	struct gene_record **recs = malloc(n * sizeof(*recs) + 1);
+	int status = -1;
+
+	if (records == NULL || recs == NULL) {
+		fputs("error: out of memory\n", stderr);
+	}
+	else if (read_index(map, trailer.index_offset, records, n) == -1) {
+		fprintf(stderr, "%s is corrupt\n", filename);
+	}
+	else {
+		for (size_t i = 0; i < n; i++) {
+			recs[i] = &records[i];
+		}
+		status = gene_tree_build(tree, recs, n);
+	}
+
+	free(recs);
+	free(records);
+
+	if (status == -1) {
+		unmap_file(map);
+		return -1;
+	}
+
+	/* from here on sequences are read where they are needed, not in order */
+	if (map->mapped) {
+		madvise(map->addr, map->len, MADV_NORMAL);
+	}
+	map->next = tree->maps;
+	tree->maps = map;
+	return 0;
+}
+
+/* STATIC FUNCTION DEFINITIONS */
+
+/* Write NODE at *OFFSET in STREAM, and advance *OFFSET past it.
+   Return 0 on success, -1 on failure. */
+static int write_record (FILE *stream, const struct gene_node *node, uint64_t *offset)
+{
+	static const char padding[8];
+	uint64_t lengths[2] = {node->defline_len, node->sequence_len};
+	uint64_t len = sizeof(lengths) + node->defline_len + node->sequence_len;
+	size_t pad = (8 - len % 8) % 8;
+
+	if (fwrite(lengths, sizeof(lengths), 1, stream) != 1 ||
+	    fwrite(node->defline, 1, node->defline_len, stream) != node->defline_len) {
+		return -1;
+	}
+
+	const char *sequence = gene_node_sequence(node);
+
+	if (sequence == NULL) {
+		fprintf(stderr, "error: unable to read sequence of %.*s\n",
+			(int) node->defline_len, node->defline);
+		return -1;
+	}
+	else if (fwrite(sequence, 1, node->sequence_len, stream) != node->sequence_len ||
+		 fwrite(padding, 1, pad, stream) != pad) {
+		return -1;
+	}
+
+	*offset += len + pad;
+	return 0;
+}
+
+/* Fill RECORDS from the N entries of the index at INDEX_OFFSET in MAP,
+   checking that each record lies within the file and that they are in
+   strictly increasing genecmp() order, as gene_tree_build() needs.
+   Return 0 on success, -1 if the index is corrupt. */
+static int read_index (const struct gene_map *map, uint64_t index_offset,
+		       struct gene_record *records, size_t n)
+{
+	const char *index = map->addr + index_offset;
+
+	for (size_t i = 0; i < n; i++) {
+		uint64_t offset;
+		uint64_t lengths[2];
+
+		memcpy(&offset, index + i * sizeof(offset), sizeof(offset));
+		if (offset < sizeof(struct snapshot_header) || offset > index_offset - sizeof(lengths)) {
+			return -1;
+		}
+		memcpy(lengths, map->addr + offset, sizeof(lengths));
+
+		uint64_t room = index_offset - offset - sizeof(lengths);
+		if (lengths[0] > room || lengths[1] > room - lengths[0]) {
+			return -1;
+		}
+
+		records[i].defline = map->addr + offset + sizeof(lengths);
+		records[i].defline_len = lengths[0];
+		records[i].sequence = records[i].defline + lengths[0];
+		records[i].sequence_len = lengths[1];
+		records[i].lazy = NULL;
+
+		if (i > 0) {
+			struct gene_node prev = {
+				.key = gene_key_prefix(records[i - 1].defline, records[i - 1].defline_len),
+				.defline = records[i - 1].defline,
+				.defline_len = records[i - 1].defline_len,
+			};
+
+			if (genecmp_key(&prev, records[i].defline, records[i].defline_len) >= 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
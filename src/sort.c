@@ -0,0 +1,156 @@
+/* sort.c - multikey quicksort on deflines */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <parse.h>
+#include <sort.h>
+
+/* partitions this small are finished off by insertion sort */
+#define INSERTION_MAX 16
+
+static int char_at (const struct gene_record *rec, size_t depth);
+static int compare_from (const struct gene_record *r1, const struct gene_record *r2, size_t depth);
+static void insertion_sort (struct gene_record **recs, size_t n, size_t depth);
+static void mkqsort (struct gene_record **recs, size_t n, size_t depth);
+
+void sort_records (struct gene_record **recs, size_t n)
+{
+	mkqsort(recs, n, 0);
+}
+
+size_t unique_records (struct gene_record **recs, size_t n)
+{
+	size_t nunique = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (nunique > 0 && compare_from(recs[nunique - 1], recs[i], 0) == 0) {
+			if (recs[i]->defline < recs[nunique - 1]->defline) {
+				recs[nunique - 1] = recs[i];
+			}
+		}
+		else {
+			recs[nunique++] = recs[i];
+		}
+	}
+
+	return nunique;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* character DEPTH of REC's defline, offset by one so the end of the
+   defline (0) sorts before any character, as in genecmp() */
+static int char_at (const struct gene_record *rec, size_t depth)
+{
+	return (depth < rec->defline_len) ? (unsigned char) rec->defline[depth] + 1 : 0;
+}
+
+/* compare deflines known to agree on their first DEPTH characters */
+static int compare_from (const struct gene_record *r1, const struct gene_record *r2, size_t depth)
+{
+	size_t len = (r1->defline_len < r2->defline_len) ? r1->defline_len : r2->defline_len;
+	int cmp = (len > depth) ? memcmp(r1->defline + depth, r2->defline + depth, len - depth) : 0;
+
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (r1->defline_len > r2->defline_len) - (r1->defline_len < r2->defline_len);
+}
+
+static void insertion_sort (struct gene_record **recs, size_t n, size_t depth)
+{
+	for (size_t i = 1; i < n; i++) {
+		struct gene_record *tmp = recs[i];
+		size_t j = i;
+
+		while (j > 0 && compare_from(recs[j - 1], tmp, depth) > 0) {
+			recs[j] = recs[j - 1];
+			--j;
+		}
+		recs[j] = tmp;
+	}
+}
+
+/*
+ * Bentley & Sedgewick's multikey quicksort: partition three ways on the
+ * character at DEPTH, then sort the < and > parts on the same character
+ * and the = part on the next one. Each character of a shared prefix is
+ * examined once per partitioning pass rather than once per comparison.
+ *
+ * The largest part is handled by looping, the others by recursion, which
+ * keeps the stack depth logarithmic.
+ */
+static void mkqsort (struct gene_record **recs, size_t n, size_t depth)
+{
+	while (n > INSERTION_MAX) {
+		/* median of three as pivot, moved to the front */
+		size_t mid = n / 2;
+		int a = char_at(recs[0], depth);
+		int b = char_at(recs[mid], depth);
+		int c = char_at(recs[n - 1], depth);
+		size_t pivot = ((a < b) ? ((b < c) ? mid : ((a < c) ? n - 1 : 0))
+				: ((a < c) ? 0 : ((b < c) ? n - 1 : mid)));
+
+		struct gene_record *tmp = recs[0];
+		recs[0] = recs[pivot];
+		recs[pivot] = tmp;
+
+		int v = char_at(recs[0], depth);
+
+		/* Dijkstra's three-way partition: [0, lt) < v, [lt, gt) == v, [gt, n) > v */
+		size_t lt = 0;
+		size_t gt = n;
+		size_t i = 0;
+
+		while (i < gt) {
+			int ci = char_at(recs[i], depth);
+
+			if (ci < v) {
+				tmp = recs[lt];
+				recs[lt++] = recs[i];
+				recs[i++] = tmp;
+			}
+			else if (ci > v) {
+				tmp = recs[--gt];
+				recs[gt] = recs[i];
+				recs[i] = tmp;
+			}
+			else {
+				++i;
+			}
+		}
+
+		size_t nless = lt;
+		size_t nequal = gt - lt;
+		size_t ngreater = n - gt;
+
+		/* deflines which ended at DEPTH are all equal: nothing left to sort */
+		if (v == 0) {
+			nequal = 0;
+		}
+
+		if (nequal >= nless && nequal >= ngreater) {
+			mkqsort(recs, nless, depth);
+			mkqsort(recs + gt, ngreater, depth);
+			recs += lt;
+			n = nequal;
+			++depth;
+		}
+		else if (nless >= ngreater) {
+			mkqsort(recs + gt, ngreater, depth);
+			mkqsort(recs + lt, nequal, depth + 1);
+			n = nless;
+		}
+		else {
+			mkqsort(recs, nless, depth);
+			mkqsort(recs + lt, nequal, depth + 1);
+			recs += gt;
+			n = ngreater;
+		}
+	}
+
+	insertion_sort(recs, n, depth);
+}
@@ -0,0 +1,198 @@
+/* strand.c - shift-and search for IUPAC patterns and their reverse complements */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <genetree.h>
+#include <search.h>
+#include <strand.h>
+
+/* bases as bits, so an ambiguity code is the union of the bases it allows */
+#define BASE_A 1
+#define BASE_C 2
+#define BASE_G 4
+#define BASE_T 8
+
+static uint8_t iupac_bases (char c);
+static char iupac_complement (char c);
+static int allows (char code, unsigned char c);
+static void compile (uint64_t *masks, const char *pattern, size_t len, size_t nwords);
+
+int strand_init (struct strand_search *search, const char *pattern, size_t len,
+		 int both_strands, struct search_out *out)
+{
+	if (len == 0 || len > STRAND_MAX_LEN) {
+		fprintf(stderr, "error: pattern must be 1 to %d bytes long\n", STRAND_MAX_LEN);
+		return -1;
+	}
+
+	search->pattern = pattern;
+	search->pattern_len = len;
+	search->both_strands = both_strands;
+	search->nwords = (len + 63) / 64;
+	search->result.out = out;
+	search->result.nrecords = 0;
+	search->result.nmatches = 0;
+	search->masks[0] = calloc(256 * search->nwords, sizeof(uint64_t));
+	search->masks[1] = NULL;
+
+	if (search->masks[0] == NULL) {
+		return -1;
+	}
+	compile(search->masks[0], pattern, len, search->nwords);
+
+	if (both_strands) {
+		char *revcomp = malloc(len);
+		search->masks[1] = calloc(256 * search->nwords, sizeof(uint64_t));
+
+		if (revcomp == NULL || search->masks[1] == NULL) {
+			free(revcomp);
+			strand_free(search);
+			return -1;
+		}
+
+		reverse_complement(revcomp, pattern, len);
+		compile(search->masks[1], revcomp, len, search->nwords);
+		free(revcomp);
+	}
+	return 0;
+}
+
+void reverse_complement (char *dest, const char *src, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		dest[i] = iupac_complement(src[len - 1 - i]);
+	}
+}
+
+void strand_free (struct strand_search *search)
+{
+	free(search->masks[0]);
+	free(search->masks[1]);
+	search->masks[0] = search->masks[1] = NULL;
+}
+
+int search_strands (const struct gene_node *node, void *arg)
+{
+	struct strand_search *search = arg;
+	const char *sequence = gene_node_sequence(node);
+	const size_t nwords = search->nwords;
+	const size_t len = search->pattern_len;
+	const int nstrands = search->both_strands ? 2 : 1;
+	const uint64_t last_bit = (uint64_t) 1 << ((len - 1) % 64);
+	int nmatches = 0;
+
+	if (sequence == NULL) {
+		fprintf(stderr, "error: unable to read sequence of %.*s\n",
+			(int) node->defline_len, node->defline);
+		return -1;
+	}
+
+	/* state[s][w] bit i : the last i + 1 bytes match the first i + 1
+	   pattern positions on strand s */
+	uint64_t state[2][nwords];
+	memset(state, 0, sizeof(state));
+
+	for (size_t j = 0; j < node->sequence_len; j++) {
+		size_t c = (unsigned char) sequence[j];
+
+		for (int s = 0; s < nstrands; s++) {
+			const uint64_t *mask = &search->masks[s][c * nwords];
+			uint64_t carry = 1; /* a match may start here */
+
+			for (size_t w = 0; w < nwords; w++) {
+				uint64_t next = (state[s][w] << 1) | carry;
+
+				carry = state[s][w] >> 63;
+				state[s][w] = next & mask[w];
+			}
+
+			if ((state[s][nwords - 1] & last_bit) == 0) {
+				continue;
+			}
+
+			size_t at = j + 1 - len;
+			size_t begin, end;
+
+			if (nmatches++ == 0) {
+				search_write_record(search->result.out, node);
+			}
+			search_context(node->sequence_len, at, len, &begin, &end);
+			search_write_match(search->result.out, sequence + begin, begin, end, node->sequence_len,
+					   at, len, (s == 0) ? "(+)" : "(-)");
+		}
+	}
+
+	if (nmatches > 0) {
+		++(search->result.nrecords);
+		search->result.nmatches += nmatches;
+	}
+	return nmatches;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* bases allowed by nucleotide code C, or 0 if it isn't one */
+static uint8_t iupac_bases (char c)
+{
+	switch (c) {
+	case 'A': case 'a': return BASE_A;
+	case 'C': case 'c': return BASE_C;
+	case 'G': case 'g': return BASE_G;
+	case 'T': case 't': return BASE_T;
+	case 'U': case 'u': return BASE_T;
+	case 'R': case 'r': return BASE_A | BASE_G;
+	case 'Y': case 'y': return BASE_C | BASE_T;
+	case 'S': case 's': return BASE_C | BASE_G;
+	case 'W': case 'w': return BASE_A | BASE_T;
+	case 'K': case 'k': return BASE_G | BASE_T;
+	case 'M': case 'm': return BASE_A | BASE_C;
+	case 'B': case 'b': return BASE_C | BASE_G | BASE_T;
+	case 'D': case 'd': return BASE_A | BASE_G | BASE_T;
+	case 'H': case 'h': return BASE_A | BASE_C | BASE_T;
+	case 'V': case 'v': return BASE_A | BASE_C | BASE_G;
+	case 'N': case 'n': return BASE_A | BASE_C | BASE_G | BASE_T;
+	default: return 0;
+	}
+}
+
+/* complement of nucleotide code C, keeping its case; anything else is kept */
+static char iupac_complement (char c)
+{
+	static const char from[] = "ACGTURYSWKMBDHVNacgturyswkmbdhvn";
+	static const char to[]   = "TGCAAYRSWMKVHDBNtgcaayrswmkvhdbn";
+	const char *p = strchr(from, c);
+
+	return (c != '\0' && p != NULL) ? to[p - from] : c;
+}
+
+/* Does pattern position CODE allow sequence byte C? Ambiguous sequence
+   bytes only match codes allowing every base they could be, and bytes
+   that aren't nucleotides match themselves, in either case. */
+static int allows (char code, unsigned char c)
+{
+	uint8_t want = iupac_bases(code);
+	uint8_t have = iupac_bases(c);
+
+	if (want != 0 && have != 0) {
+		return (have & ~want) == 0;
+	}
+
+	unsigned char lower_code = (code >= 'A' && code <= 'Z') ? code + ('a' - 'A') : code;
+	unsigned char lower_c = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	return want == 0 && have == 0 && lower_code == lower_c;
+}
+
+static void compile (uint64_t *masks, const char *pattern, size_t len, size_t nwords)
+{
+	for (size_t c = 0; c < 256; c++) {
+		for (size_t i = 0; i < len; i++) {
+			if (allows(pattern[i], c)) {
+				masks[c * nwords + i / 64] |= (uint64_t) 1 << (i % 64);
+			}
+		}
+	}
+}
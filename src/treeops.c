@@ -5,91 +5,219 @@
 #include <string.h>
 
 #include <genetree.h>
+#include <treeops.h>
+#include <mapfile.h>
+#include <parse.h>
+#include <sort.h>
 #include <dsw.h>
+#include <faidx.h>
+#include <hashindex.h>
+#include <walk.h>
+
+/* operate_tree()'s callback, wrapped to pass as a data pointer */
+struct node_op {
+	void (*fn)(const struct gene_node *);
+};
+
+static int cursor_push (struct tree_cursor *cursor, struct gene_node *node);
+static long load_records (struct gene_tree *tree, size_t nthreads, int lazy,
+			  struct record_list **lists, struct faidx **index);
+static int apply_op (const struct gene_node *node, void *op);
+static void keep_indexed (struct gene_tree *tree, struct gene_node *node);
+static int pack_nodes (struct gene_tree *tree, size_t *npacked);
+static int pack_node (struct gene_tree *tree, struct gene_node *node, size_t *npacked);
+static int match_records (const struct gene_tree *tree, struct gene_record **recs, size_t n,
+			  int relink);
+
+int cursor_init (struct tree_cursor *cursor, const struct gene_tree *tree)
+{
+	cursor->stack = NULL;
+	cursor->depth = 0;
+	cursor->capacity = 0;
+	cursor->order = CURSOR_IN_ORDER;
+
+	/* the first node is at the bottom of the left spine */
+	for (struct gene_node *node = tree->root; node != NULL; node = node->left) {
+		if (cursor_push(cursor, node) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
 
-/* Populate initialised gene_tree.
-   Return 0 on success, -1 on failure*/
-int fill_tree (struct gene_tree *tree)
+int cursor_init_preorder (struct tree_cursor *cursor, const struct gene_tree *tree)
 {
-	FILE *ifptr;
+	cursor->stack = NULL;
+	cursor->depth = 0;
+	cursor->capacity = 0;
+	cursor->order = CURSOR_PRE_ORDER;
 
-	if ((ifptr = fopen(tree->filename, "r")) == NULL) {
-		fprintf(stderr, "unable to open file %s\n", tree->filename);
-		return -1;
+	if (tree->root != NULL) {
+		return cursor_push(cursor, tree->root);
 	}
+	return 0;
+}
 
-	char *defline_buf = NULL;
-	char *sequence_buf = NULL;
+int cursor_seek (struct tree_cursor *cursor, const struct gene_tree *tree,
+		 const char *key, size_t len)
+{
+	cursor->stack = NULL;
+	cursor->depth = 0;
+	cursor->capacity = 0;
+	cursor->order = CURSOR_IN_ORDER;
+
+	/* Descend as for a lookup, stacking each node we go left at: these
+	   are exactly the nodes not less than KEY still to be visited, with
+	   the least of them on top. */
+	struct gene_node *node = tree->root;
+
+	while (node != NULL) {
+		if (genecmp_key(node, key, len) >= 0) {
+			if (cursor_push(cursor, node) == -1) {
+				return -1;
+			}
+			node = node->left;
+		}
+		else {
+			node = node->right;
+		}
+	}
+	return 0;
+}
 
-	/* lengths NOT including trailing null character */
-	size_t defline_len = 0;
-	size_t sequence_len = 0;
+struct gene_node *cursor_next (struct tree_cursor *cursor)
+{
+	if (cursor->depth == 0) {
+		return NULL;
+	}
 
-	/* Step down through file, inserting a node into the tree when a header and matching sequence
-           are found. */
+	struct gene_node *next = cursor->stack[--(cursor->depth)];
+	int status = 0;
 
-	while (getline(&sequence_buf, &sequence_len, ifptr) != -1) {
+	if (cursor->order == CURSOR_PRE_ORDER) {
+		/* left subtree first, so push it last */
+		if (next->right != NULL) {
+			status = cursor_push(cursor, next->right);
+		}
+		if (next->left != NULL && status == 0) {
+			status = cursor_push(cursor, next->left);
+		}
+	}
+	else {
+		/* its successor is the least node of its right subtree, if any */
+		for (struct gene_node *node = next->right; node != NULL && status == 0; node = node->left) {
+			status = cursor_push(cursor, node);
+		}
+	}
 
-		if (*sequence_buf == '>') {
+	if (status == -1) {
+		/* can't continue: end the walk here rather than skip nodes */
+		cursor->depth = 0;
+	}
+	else if (cursor->depth > 0) {
+		/* the caller works on NEXT meanwhile: fetch the node after it */
+		__builtin_prefetch(cursor->stack[cursor->depth - 1]);
+	}
+	return next;
+}
 
-			/* 
-			 * sequence_len excludes trailing null character, but strcpy expects a
-			 * destination large enough to include it.
-			 *
-			 * Since strcpy() does not check argument lengths it is our responsibility
-			 * to allocate enough space before copying! 
-			 */
-			
-			defline_len = sequence_len - 1;
+void cursor_free (struct tree_cursor *cursor)
+{
+	free(cursor->stack);
+	cursor->stack = NULL;
+	cursor->depth = 0;
+	cursor->capacity = 0;
+}
 
-			/* need a temporary buffer to properly handle errors, since realloc
-			   will return NULL but leave initial buffer unchanged */
-			char *tmp_buf = realloc(defline_buf, defline_len + 1);
-			if (tmp_buf == NULL) {
-				free(defline_buf);
-				defline_buf = NULL;
+/* Populate initialised gene_tree, parsing with up to NTHREADS threads, or
+   leaving sequences in the file until needed if LAZY.
+   Return 0 on success, -1 on failure*/
+int fill_tree (struct gene_tree *tree, size_t nthreads, int lazy)
+{
+	struct record_list *lists;
+	struct faidx *index;
+	long nlists = load_records(tree, nthreads, lazy, &lists, &index);
 
-				free(sequence_buf);
-				sequence_buf = NULL;
-				
-				fclose(ifptr);
-				return -1;
-			}
-			else {
-				defline_buf = tmp_buf;
-				strcpy(defline_buf, sequence_buf + 1);
-			}
-		}
-		else {
-			if(gene_tree_insert(tree, defline_buf, defline_len, sequence_buf, sequence_len) == -1) {
-				free(defline_buf);
-				defline_buf = NULL;
-				
-				free(sequence_buf);
-				sequence_buf = NULL;
-				
-				fclose(ifptr);  /* NO CHECK ON RETURN VALUE -- what would I do? */
-				return -1;
-			}
+	if (nlists == -1) {
+		return -1;
+	}
+
+	size_t nrecs = 0;
+	for (long i = 0; i < nlists; i++) {
+		nrecs += lists[i].size;
+	}
+
+	struct gene_record **recs = malloc(nrecs * sizeof(*recs) + 1);
+	if (recs == NULL) {
+		free_record_lists(lists, nlists);
+		faidx_free(index);
+		return -1;
+	}
+
+	size_t k = 0;
+	for (long i = 0; i < nlists; i++) {
+		for (size_t j = 0; j < lists[i].size; j++) {
+			recs[k++] = &lists[i].records[j];
 		}
 	}
 
-	free(sequence_buf);
-	sequence_buf = NULL;
-	
-	free(defline_buf);
-	defline_buf = NULL;
-	
-	fclose(ifptr); /* NO CHECK ON RETURN VALUE */
+	/* Sort and build the balanced tree in one go, rather than inserting
+	   record by record into a tree which sorted input would degenerate
+	   into a list. unique_records() keeps the first of any duplicate
+	   deflines, as insertion did. */
+	sort_records(recs, nrecs);
+	nrecs = unique_records(recs, nrecs);
 
-	return 0;
+	int status = 0;
+
+	if (tree->root == NULL) {
+		status = gene_tree_build(tree, recs, nrecs);
+	}
+	else {
+		for (size_t i = 0; i < nrecs && status == 0; i++) {
+			status = gene_tree_insert(tree, recs[i]->defline, recs[i]->defline_len,
+						  recs[i]->sequence, recs[i]->sequence_len);
+		}
+	}
+
+	/* the tree has its own copies of the deflines now */
+	free(recs);
+	free_record_lists(lists, nlists);
+	faidx_free(index);
+	return status;
 }
 
+/* Merge SRC_TREE into DEST_TREE and free SRC_TREE. Where both trees
+   hold the same defline, DEST_TREE's node is kept.
+   Return 0 on success, -1 on failure (both trees are left intact). */
 int merge_tree ( struct gene_tree *src_tree, struct gene_tree *dest_tree)
 {
+	struct gene_node **merged = NULL;
+
+	if (src_tree->root != NULL && dest_tree->root != NULL) {
+		merged = malloc((src_tree->size + dest_tree->size) * sizeof(*merged));
+		if (merged == NULL) {
+			fprintf(stderr, "merge error: out of memory\n");
+			return -1;
+		}
+	}
+
+	/* nodes in src_tree live in its arenas and point into its maps, all of
+	   which dest_tree now owns */
+	gene_tree_adopt(dest_tree, src_tree);
+
 	if (dest_tree->root == NULL) {
-		free_gene_tree(dest_tree);
-		dest_tree = src_tree;
+		dest_tree->root = src_tree->root;
+		dest_tree->size = src_tree->size;
+
+		if (dest_tree->index != NULL) {
+			struct gene_index *index = index_build(dest_tree, dest_tree->index->key);
+			index_free(dest_tree->index);
+			dest_tree->index = index;
+		}
+
+		src_tree->root = NULL;
+		free_gene_tree(src_tree);
 		return 0;
 	}
 	else if (src_tree->root == NULL) {
@@ -97,131 +225,447 @@ int merge_tree ( struct gene_tree *src_tree, struct gene_tree *dest_tree)
 		return 0;
 	}
 
-	/* right rotate src_tree to a singly-linked list */
+	/* Unroll both trees into sorted vines and merge them in a single pass,
+	   then rebuild a balanced tree directly from the merged order: O(n + m),
+	   with no descent from the root per node. */
 	tree_to_vine(src_tree);
-	
-	do { /* while (src_tree->root != NULL) */
-		int nodecmp;
+	tree_to_vine(dest_tree);
 
-		struct gene_node *curr_node = dest_tree->root;
-		struct gene_node *prev_node = NULL;
+	struct gene_node *src_node = src_tree->root;
+	struct gene_node *dest_node = dest_tree->root;
+	size_t nmerged = 0;
 
-		do { /* while (curr_node != NULL) */
+	while (src_node != NULL && dest_node != NULL) {
+		int nodecmp = genecmp(src_node, dest_node);
 
-			nodecmp = genecmp(src_tree->root, curr_node);
-			if (nodecmp < 0) {
-				prev_node = curr_node;
-				curr_node = curr_node->left;
-			}
-			else if (nodecmp > 0) {
-				prev_node = curr_node;
-				curr_node = curr_node->right;
-			}
-			else {
-				break;
+		if (nodecmp < 0) {
+			keep_indexed(dest_tree, src_node);
+			merged[nmerged++] = src_node;
+			src_node = src_node->right;
+		}
+		else {
+			/* on a tie src_node is already in dest_tree - drop it.
+			   its memory is reclaimed along with the rest of the arena */
+			if (nodecmp == 0) {
+				src_node = src_node->right;
 			}
-		} while (curr_node != NULL);
-
-		if (nodecmp == 0) {
-			/* src_node is already in dest_tree - pop off src_tree and free */
-			struct gene_node *old_head = src_tree->root;
-			
-			src_tree->root = src_tree->root->right;
-			--(src_tree->size);
-
-			free(old_head->defline);
-			free(old_head->sequence);
-			old_head->defline = NULL;
-			old_head->sequence = NULL;
-
-			free(old_head);
-		}
-		/* src_node not already in dest_tree - pop off src_tree and add to dest_tree */
-		else if (nodecmp < 0) {
-			prev_node->left = src_tree->root;
-			++(dest_tree->size);
-
-			src_tree->root = src_tree->root->right;
-			--(src_tree->size);
-			
-			prev_node->left->left = NULL;
-			prev_node->left->right = NULL;
-		}
-		else if (nodecmp > 0) {
-			prev_node->right = src_tree->root;
-			++(dest_tree->size);
-			
-			src_tree->root = src_tree->root->right;
-			--(src_tree->size);
-			
-			prev_node->right->left = NULL;
-			prev_node->right->right = NULL;
-		}
-		
-	} while (src_tree->root != NULL);
-
-	/* sanity check - size of empty tree should be 0 */
-	if (src_tree->size != 0) {
-		fprintf(stderr, "merge error: possible memory leak\n");
-		return -1;
+			merged[nmerged++] = dest_node;
+			dest_node = dest_node->right;
+		}
+	}
+	for (; src_node != NULL; src_node = src_node->right) {
+		keep_indexed(dest_tree, src_node);
+		merged[nmerged++] = src_node;
+	}
+	for (; dest_node != NULL; dest_node = dest_node->right) {
+		merged[nmerged++] = dest_node;
 	}
 
+	dest_tree->root = build_balanced_tree(merged, nmerged);
+	dest_tree->size = nmerged;
+	free(merged);
 
 	/* free empty src_tree and set to NULL so the file_array element can be reallocated */
+	src_tree->root = NULL;
+	src_tree->size = 0;
 	free_gene_tree(src_tree);
 	src_tree = NULL;
 
-	balance_tree(dest_tree);
 	return 0;
 }
 
-/* recursively print labels on binary tree */
-void print_tree (const struct gene_node *root, FILE *stream)
+/* Convert TREE to packed storage and release its maps.
+   Return number of sequences packed, or -1 on failure. */
+long pack_tree (struct gene_tree *tree)
 {
-	if (root != NULL) {
-		fprintf(stream, ">%s\n", root->defline);
-		print_tree(root->left, stream);
-		print_tree(root->right, stream);
+	size_t npacked = 0;
+
+	if (pack_nodes(tree, &npacked) == -1) {
+		return -1;
+	}
+
+	/* nothing points into the maps any more */
+	unmap_file_list(tree->maps);
+	tree->maps = NULL;
+
+	return npacked;
+}
+
+int evict_tree (struct gene_tree *tree)
+{
+	struct gene_map *file = tree->maps;
+
+	/* a snapshot, merge, decompressed or packed buffer has no one file to
+	   read its sequences back from */
+	if (file == NULL || file->next != NULL || !file->mapped || file->fd != -1 ||
+	    file->len == 0 || file->addr[0] != '>' || tree->seq_arena.total != 0) {
+		return 0;
+	}
+
+	struct faidx *index = faidx_load(tree->filename);
+
+	if (index == NULL && (faidx_build(tree->filename) == -1 ||
+			      (index = faidx_load(tree->filename)) == NULL)) {
+		return 0;
+	}
+
+	struct gene_map *lazy_file = open_file(tree->filename);
+	struct record_list *list = calloc(1, sizeof(*list));
+	struct gene_record **recs = NULL;
+	struct arena locations;
+	int status = -1;
+
+	arena_init(&locations);
+	if (lazy_file != NULL && list != NULL &&
+	    faidx_lazy_records(index, lazy_file->fd, &locations, list) == 0 &&
+	    (recs = malloc(list->size * sizeof(*recs) + 1)) != NULL) {
+
+		for (size_t i = 0; i < list->size; i++) {
+			recs[i] = &list->records[i];
+		}
+
+		/* the same records, in the same order, as fill_tree() built from */
+		sort_records(recs, list->size);
+		size_t nrecs = unique_records(recs, list->size);
+
+		/* check every node before changing any */
+		if ((status = match_records(tree, recs, nrecs, 0)) == 1) {
+			status = match_records(tree, recs, nrecs, 1);
+		}
 	}
+
+	if (status == 1) {
+		/* nothing points into the map any more */
+		arena_adopt(&tree->seq_arena, &locations);
+		unmap_file(tree->maps);
+		tree->maps = lazy_file;
+	}
+	else {
+		arena_free(&locations);
+		unmap_file(lazy_file);
+	}
+
+	free(recs);
+	free_record_lists(list, 1);
+	faidx_free(index);
+	return status;
 }
 
-/* recursively print full contents of binary tree */
-void print_tree_full (const struct gene_node *root, FILE *stream)
+/* print defline and sequence of a single node */
+void print_node (const struct gene_node *node, FILE *stream)
 {
-	if (root != NULL) {
-		fprintf(stream, ">%s%s", root->defline, root->sequence);
-		print_tree_full(root->left, stream);
-		print_tree_full(root->right, stream);
+	const char *sequence = gene_node_sequence(node);
+
+	fputc('>', stream);
+	fwrite(node->defline, 1, node->defline_len, stream);
+	fputc('\n', stream);
+	if (sequence != NULL) {
+		fwrite(sequence, 1, node->sequence_len, stream);
+	}
+	else {
+		fprintf(stderr, "error: unable to read sequence of %.*s\n",
+			(int) node->defline_len, node->defline);
 	}
+	fputc('\n', stream);
 }
 
-int search_tree (const struct gene_node *root, const char *string,
-		 int (*search_fn)(const char *, const char *, const char *))
+/* print deflines of TREE in order */
+int print_tree (const struct gene_tree *tree, FILE *stream)
 {
-	int count = 0;
-	if (root != NULL) {
-		if ((*search_fn)(root->defline, root->sequence, string) == 1) {
-			++count;
-//			fprintf(stdout, "Match found: %s\n", root->defline);
-		}
-		count += search_tree(root->left, string, search_fn);
-		count += search_tree(root->right, string, search_fn);
+	struct tree_cursor cursor;
+	struct gene_node *node;
+
+	if (cursor_init(&cursor, tree) == -1) {
+		cursor_free(&cursor);
+		return -1;
+	}
+
+	while ((node = cursor_next(&cursor)) != NULL) {
+		fputc('>', stream);
+		fwrite(node->defline, 1, node->defline_len, stream);
+		fputc('\n', stream);
+	}
+
+	cursor_free(&cursor);
+	return 0;
+}
+
+/* write full contents of TREE in order */
+int print_tree_full (const struct gene_tree *tree, struct record_writer *writer)
+{
+	struct tree_cursor cursor;
+	struct gene_node *node;
+
+	if (cursor_init(&cursor, tree) == -1) {
+		cursor_free(&cursor);
+		return -1;
+	}
+
+	int status = 0;
+
+	while (status == 0 && (node = cursor_next(&cursor)) != NULL) {
+		status = writer_record(writer, node);
 	}
+
+	cursor_free(&cursor);
+	return status;
+}
+
+/* Call SEARCH_FN with ARG on every node of TREE, on up to NTHREADS threads.
+   Return the number of nodes for which it reports a match, or -1 on failure. */
+long search_tree (const struct gene_tree *tree, void *arg, size_t arg_size,
+		  int (*search_fn)(const struct gene_node *, void *), size_t nthreads)
+{
+	return walk_tree(tree, search_fn, arg, arg_size, nthreads);
+}
+
+/* Print, in order, every node whose defline starts with PREFIX. The matches
+   are contiguous in defline order, so only they are visited after an
+   O(log n) descent. Return number printed, or -1 on failure. */
+long print_prefix (const struct gene_tree *tree, const char *prefix, FILE *stream)
+{
+	struct tree_cursor cursor;
+	struct gene_node *node;
+	size_t prefix_len = strlen(prefix);
+	long count = 0;
+
+	if (cursor_seek(&cursor, tree, prefix, prefix_len) == -1) {
+		cursor_free(&cursor);
+		return -1;
+	}
+
+	while ((node = cursor_next(&cursor)) != NULL &&
+	       node->defline_len >= prefix_len && memcmp(node->defline, prefix, prefix_len) == 0) {
+		print_node(node, stream);
+		++count;
+	}
+
+	cursor_free(&cursor);
 	return count;
 }
 
-/* operate recursively on binary tree nodes.
+/* Print, in order, every node whose defline is in [FROM, TO).
+   Return number printed, or -1 on failure. */
+long print_range (const struct gene_tree *tree, const char *from, const char *to, FILE *stream)
+{
+	struct tree_cursor cursor;
+	struct gene_node *node;
+	size_t to_len = strlen(to);
+	long count = 0;
+
+	if (cursor_seek(&cursor, tree, from, strlen(from)) == -1) {
+		cursor_free(&cursor);
+		return -1;
+	}
+
+	while ((node = cursor_next(&cursor)) != NULL && genecmp_key(node, to, to_len) < 0) {
+		print_node(node, stream);
+		++count;
+	}
+
+	cursor_free(&cursor);
+	return count;
+}
+
+/* Call NODE_OP on every node of TREE, on up to NTHREADS threads.
    NOTE: if contents are changed, tree may need rebalancing. */
+int operate_tree (const struct gene_tree *tree,
+		  void (*node_op)(const struct gene_node *), size_t nthreads)
+{
+	struct node_op op = { node_op };
+
+	return (walk_tree(tree, &apply_op, &op, 0, nthreads) == -1) ? -1 : 0;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+static int cursor_push (struct tree_cursor *cursor, struct gene_node *node)
+{
+	if (cursor->depth == cursor->capacity) {
+		size_t capacity = (cursor->capacity == 0) ? 64 : 2 * cursor->capacity;
+
+		/* need a temporary buffer, since realloc leaves the stack unchanged on failure */
+		struct gene_node **tmp = realloc(cursor->stack, capacity * sizeof(*tmp));
+		if (tmp == NULL) {
+			return -1;
+		}
+		cursor->stack = tmp;
+		cursor->capacity = capacity;
+	}
+
+	cursor->stack[cursor->depth++] = node;
+	return 0;
+}
 
-void operate_tree (const struct gene_node *root,
-		   void (*node_op)(char *, char *))
+/* walk_tree() visitor calling the node_op passed as its argument */
+static int apply_op (const struct gene_node *node, void *op)
 {
+	(*((struct node_op *) op)->fn)(node);
+	return 0;
+}
 
-	if (root != NULL) {
-	        (*node_op)(root->defline, root->sequence);
-		operate_tree(root->left, node_op);
-		operate_tree(root->right, node_op);
+/* Read the records of TREE's file into *LISTS, through its index if it has
+   an up-to-date one, and hand the file's storage to TREE. LAZY needs an
+   index, so one is built if need be. Deflines read through an index point
+   into it, so it is left in *INDEX (or NULL there if none was used) for the
+   caller to faidx_free() once the tree has copied them. Return the number
+   of lists, as parse_records_parallel() does, or -1 on failure. */
+static long load_records (struct gene_tree *tree, size_t nthreads, int lazy,
+			  struct record_list **lists, struct faidx **index_out)
+{
+	struct faidx *index = faidx_load(tree->filename);
+
+	*index_out = NULL;
+
+	if (lazy && index == NULL) {
+		/* and keep it, so the next lazy read is quick */
+		if (faidx_build(tree->filename) == -1 || (index = faidx_load(tree->filename)) == NULL) {
+			fprintf(stderr, "unable to read %s lazily\n", tree->filename);
+			return -1;
+		}
 	}
+
+	if (index == NULL) {
+		struct gene_map *map = map_input(tree->filename, nthreads);
+
+		if (map == NULL) {
+			return -1;
+		}
+
+		/* nodes point into the map, so hand it to the tree before parsing */
+		map->next = tree->maps;
+		tree->maps = map;
+
+		return parse_records_parallel(map->addr, map->addr + map->len, nthreads, lists);
+	}
+
+	/* the index gives every record's place: no need to parse */
+	struct gene_map *map = lazy ? open_file(tree->filename) : map_file(tree->filename);
+
+	*lists = calloc(1, sizeof(**lists));
+	if (map == NULL || *lists == NULL) {
+		unmap_file(map);
+		free(*lists);
+		faidx_free(index);
+		return -1;
+	}
+
+	/* sequences point into (or are read from) the file */
+	map->next = tree->maps;
+	tree->maps = map;
+
+	int status = lazy ? faidx_lazy_records(index, map->fd, &tree->seq_arena, *lists) :
+		faidx_records(index, map->addr, map->len, nthreads, *lists);
+
+	if (status == -1) {
+		fprintf(stderr, "error: index of %s doesn't match it\n", tree->filename);
+		free_record_lists(*lists, 1);
+		faidx_free(index);
+		return -1;
+	}
+	*index_out = index;
+	return 1;
+}
+
+/* add NODE, newly merged into TREE, to TREE's index if it has one */
+static void keep_indexed (struct gene_tree *tree, struct gene_node *node)
+{
+	if (tree->index != NULL && index_insert(tree->index, node) == -1) {
+		/* an incomplete index would give wrong answers: drop it */
+		fprintf(stderr, "warning: out of memory updating index of %s, index dropped\n",
+			tree->filename);
+		index_free(tree->index);
+		tree->index = NULL;
+	}
+}
+
+/* Pack sequences of every node of TREE into its sequence arena, copying
+   any unpackable sequences there too so the tree no longer refers to its
+   maps (deflines are already in the tree's own arena). Nodes are visited in order, so records that are read together
+   lie together. Return 0 on success, -1 on failure. */
+static int pack_nodes (struct gene_tree *tree, size_t *npacked)
+{
+	struct tree_cursor cursor;
+	struct gene_node *node;
+	int status = 0;
+
+	if (cursor_init(&cursor, tree) == -1) {
+		cursor_free(&cursor);
+		return -1;
+	}
+
+	while (status == 0 && (node = cursor_next(&cursor)) != NULL) {
+		status = pack_node(tree, node, npacked);
+	}
+
+	cursor_free(&cursor);
+	return status;
+}
+
+static int pack_node (struct gene_tree *tree, struct gene_node *node, size_t *npacked)
+{
+	if (node->packed == NULL) {
+		/* a lazy node's sequence is read in, and then held like any other */
+		const char *text = gene_node_sequence(node);
+		if (text == NULL) {
+			return -1;
+		}
+
+		struct packed_seq *packed = pack_sequence(&tree->seq_arena, text, node->sequence_len);
+
+		if (packed != NULL) {
+			node->packed = packed;
+			node->sequence = NULL;
+			++(*npacked);
+		}
+		else {
+			/* not DNA, or no smaller packed: keep the text */
+			const char *sequence = arena_memdup(&tree->seq_arena, text, node->sequence_len);
+			if (sequence == NULL) {
+				return -1;
+			}
+			node->sequence = sequence;
+		}
+		node->lazy = NULL;
+	}
+	return 0;
+}
+
+/* Do the N sorted RECS hold the deflines and sequence lengths of TREE's
+   nodes, in order? If so and RELINK is set, point each node at its
+   record's lazy sequence instead of its own. Return 1 if they match, 0 if
+   not, -1 on failure. */
+static int match_records (const struct gene_tree *tree, struct gene_record **recs, size_t n,
+			  int relink)
+{
+	struct tree_cursor cursor;
+	struct gene_node *node;
+	size_t i = 0;
+
+	if (n != tree->size) {
+		return 0;
+	}
+	else if (cursor_init(&cursor, tree) == -1) {
+		cursor_free(&cursor);
+		return -1;
+	}
+
+	while ((node = cursor_next(&cursor)) != NULL) {
+		const struct gene_record *rec = recs[i++];
+
+		if (node->defline_len != rec->defline_len || node->sequence_len != rec->sequence_len ||
+		    memcmp(node->defline, rec->defline, rec->defline_len) != 0) {
+			cursor_free(&cursor);
+			return 0;
+		}
+		else if (relink) {
+			node->sequence = NULL;
+			node->lazy = rec->lazy;
+		}
+	}
+
+	cursor_free(&cursor);
+	return 1;
 }
-		
-		
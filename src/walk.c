@@ -0,0 +1,391 @@
+/* walk.c - work-stealing parallel traversal of a gene_tree */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <genetree.h>
+#include <search.h>
+#include <treeops.h>
+#include <walk.h>
+
+/* nodes taken from a range at a time */
+#define BATCH 8
+
+/* below this many nodes per thread, threads cost more than they save */
+#define NODES_PER_THREAD_MIN 64
+
+/* output of the nodes [START, END) run by one thread in one go */
+struct walk_chunk {
+	size_t start;
+	size_t end;
+
+	char *text;
+	size_t len;
+
+	FILE *stream;
+	struct search_out *out;
+
+	struct walk_chunk *next;
+};
+
+struct walk_shared;
+
+struct walk_worker {
+	pthread_mutex_t lock;
+	size_t next; /* range of nodes still to visit, guarded by LOCK */
+	size_t end;
+
+	void *arg; /* private copy, or the shared ARG */
+	struct walk_chunk *chunks; /* most recent first */
+	long count;
+	int status;
+
+	struct walk_shared *shared;
+};
+
+struct walk_shared {
+	struct gene_node **nodes;
+	size_t nnodes;
+
+	struct walk_worker *workers;
+	size_t nworkers;
+
+	int (*visit)(const struct gene_node *, void *);
+	size_t arg_size;
+};
+
+static void *walk_worker_run (void *arg);
+static int take_batch (struct walk_worker *worker, size_t *begin, size_t *end);
+static int steal (struct walk_worker *thief);
+static int visit_batch (struct walk_worker *worker, size_t begin, size_t end);
+static int close_chunk (struct walk_chunk *chunk);
+static int chunk_cmp (const void *a, const void *b);
+
+long walk_tree (const struct gene_tree *tree, int (*visit)(const struct gene_node *, void *),
+		void *arg, size_t arg_size, size_t nthreads)
+{
+	struct walk_shared shared;
+	struct tree_cursor cursor;
+	struct gene_node *node;
+
+	if (nthreads > tree->size / NODES_PER_THREAD_MIN) {
+		nthreads = tree->size / NODES_PER_THREAD_MIN;
+	}
+
+	/* one thread: visit in order, straight into ARG */
+	if (nthreads <= 1) {
+		long count = 0;
+
+		if (cursor_init(&cursor, tree) == -1) {
+			return -1;
+		}
+		while ((node = cursor_next(&cursor)) != NULL) {
+			int found = (*visit)(node, arg);
+
+			if (found < 0) {
+				count = -1;
+				break;
+			}
+			count += (found > 0);
+		}
+		cursor_free(&cursor);
+		return count;
+	}
+
+	shared.nodes = malloc(tree->size * sizeof(*shared.nodes));
+	shared.workers = calloc(nthreads, sizeof(*shared.workers));
+	shared.nnodes = 0;
+	shared.nworkers = nthreads;
+	shared.visit = visit;
+	shared.arg_size = arg_size;
+
+	if (shared.nodes == NULL || shared.workers == NULL || cursor_init(&cursor, tree) == -1) {
+		free(shared.nodes);
+		free(shared.workers);
+		return -1;
+	}
+	while ((node = cursor_next(&cursor)) != NULL) {
+		shared.nodes[shared.nnodes++] = node;
+	}
+	cursor_free(&cursor);
+
+	/* deal equal ranges; stealing evens out the work from there */
+	pthread_t *threads = malloc(nthreads * sizeof(*threads));
+	size_t started = 0;
+	int status = (threads == NULL) ? -1 : 0;
+
+	for (size_t i = 0; i < nthreads; i++) {
+		struct walk_worker *worker = &shared.workers[i];
+
+		pthread_mutex_init(&worker->lock, NULL);
+		worker->next = shared.nnodes * i / nthreads;
+		worker->end = shared.nnodes * (i + 1) / nthreads;
+		worker->shared = &shared;
+		worker->arg = arg;
+
+		if (arg_size > 0) {
+			if ((worker->arg = malloc(arg_size)) == NULL) {
+				status = -1;
+				continue;
+			}
+			memcpy(worker->arg, arg, arg_size);
+			((struct search_result *) worker->arg)->nrecords = 0;
+			((struct search_result *) worker->arg)->nmatches = 0;
+		}
+	}
+
+	for (size_t i = 0; status == 0 && i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, &walk_worker_run, &shared.workers[i]) != 0) {
+			break;
+		}
+		++started;
+	}
+
+	/* workers whose thread couldn't be started run here instead, each
+	   visiting its own range and then stealing, as a thread would */
+	for (size_t i = started; status == 0 && i < nthreads; i++) {
+		walk_worker_run(&shared.workers[i]);
+	}
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	long count = 0;
+	size_t nchunks = 0;
+
+	for (size_t i = 0; i < nthreads; i++) {
+		struct walk_worker *worker = &shared.workers[i];
+
+		if (worker->status == -1) {
+			status = -1;
+		}
+		count += worker->count;
+		for (struct walk_chunk *chunk = worker->chunks; chunk != NULL; chunk = chunk->next) {
+			++nchunks;
+		}
+	}
+
+	/* output in defline order, whichever thread produced it */
+	if (arg_size > 0) {
+		struct search_result *result = arg;
+		struct walk_chunk **chunks = malloc((nchunks ? nchunks : 1) * sizeof(*chunks));
+
+		if (chunks == NULL) {
+			status = -1;
+		}
+
+		nchunks = 0;
+		for (size_t i = 0; i < nthreads; i++) {
+			struct walk_worker *worker = &shared.workers[i];
+			struct search_result *part = worker->arg;
+
+			for (struct walk_chunk *chunk = worker->chunks; chunk != NULL; chunk = chunk->next) {
+				if (chunks != NULL) {
+					chunks[nchunks++] = chunk;
+				}
+			}
+			if (part != NULL) {
+				result->nrecords += part->nrecords;
+				result->nmatches += part->nmatches;
+			}
+		}
+
+		if (chunks != NULL) {
+			qsort(chunks, nchunks, sizeof(*chunks), &chunk_cmp);
+			for (size_t i = 0; i < nchunks; i++) {
+				search_out_write(result->out, chunks[i]->text, chunks[i]->len);
+			}
+		}
+		free(chunks);
+	}
+
+	for (size_t i = 0; i < nthreads; i++) {
+		struct walk_worker *worker = &shared.workers[i];
+		struct walk_chunk *chunk = worker->chunks;
+
+		while (chunk != NULL) {
+			struct walk_chunk *next = chunk->next;
+			free(chunk->text);
+			free(chunk);
+			chunk = next;
+		}
+		if (arg_size > 0) {
+			free(worker->arg);
+		}
+		pthread_mutex_destroy(&worker->lock);
+	}
+
+	free(threads);
+	free(shared.workers);
+	free(shared.nodes);
+	return (status == -1) ? -1 : count;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+static void *walk_worker_run (void *arg)
+{
+	struct walk_worker *worker = arg;
+	size_t begin, end;
+
+	if (worker->arg == NULL) {
+		worker->status = -1;
+		return NULL;
+	}
+
+	for (;;) {
+		if (take_batch(worker, &begin, &end) == 0 || (steal(worker) && take_batch(worker, &begin, &end) == 0)) {
+			if (visit_batch(worker, begin, end) == -1) {
+				worker->status = -1;
+				break;
+			}
+		}
+		else {
+			break;
+		}
+	}
+
+	if (worker->chunks != NULL && close_chunk(worker->chunks) == -1) {
+		worker->status = -1;
+	}
+	return NULL;
+}
+
+/* Take up to BATCH nodes from the front of WORKER's range.
+   Return 0 on success, -1 if the range is empty. */
+static int take_batch (struct walk_worker *worker, size_t *begin, size_t *end)
+{
+	int status = -1;
+
+	pthread_mutex_lock(&worker->lock);
+	if (worker->next < worker->end) {
+		*begin = worker->next;
+		*end = (worker->end - worker->next > BATCH) ? worker->next + BATCH : worker->end;
+		worker->next = *end;
+		status = 0;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return status;
+}
+
+/* Move the back half of the largest remaining range to THIEF.
+   Return 1 if anything was stolen, 0 if there was nothing left. */
+static int steal (struct walk_worker *thief)
+{
+	struct walk_shared *shared = thief->shared;
+
+	for (;;) {
+		struct walk_worker *victim = NULL;
+		size_t most = 0;
+
+		for (size_t i = 0; i < shared->nworkers; i++) {
+			struct walk_worker *worker = &shared->workers[i];
+
+			if (worker == thief) {
+				continue;
+			}
+			pthread_mutex_lock(&worker->lock);
+			size_t left = worker->end - worker->next;
+			pthread_mutex_unlock(&worker->lock);
+
+			if (left > most) {
+				most = left;
+				victim = worker;
+			}
+		}
+		if (victim == NULL) {
+			return 0;
+		}
+
+		/* it may have shrunk since: take half of what is left now */
+		size_t begin, end;
+
+		pthread_mutex_lock(&victim->lock);
+		end = victim->end;
+		begin = end - (victim->end - victim->next + 1) / 2;
+		victim->end = begin;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (begin < end) {
+			pthread_mutex_lock(&thief->lock);
+			thief->next = begin;
+			thief->end = end;
+			pthread_mutex_unlock(&thief->lock);
+			return 1;
+		}
+	}
+}
+
+static int visit_batch (struct walk_worker *worker, size_t begin, size_t end)
+{
+	struct walk_shared *shared = worker->shared;
+	struct walk_chunk *chunk = worker->chunks;
+
+	/* output goes to a chunk of its own unless it follows on from the last */
+	if (shared->arg_size > 0 && (chunk == NULL || chunk->end != begin)) {
+		if (chunk != NULL && close_chunk(chunk) == -1) {
+			return -1;
+		}
+
+		if ((chunk = calloc(1, sizeof(*chunk))) == NULL ||
+		    (chunk->out = malloc(sizeof(*chunk->out))) == NULL ||
+		    (chunk->stream = open_memstream(&chunk->text, &chunk->len)) == NULL) {
+			if (chunk != NULL) {
+				free(chunk->out);
+			}
+			free(chunk);
+			return -1;
+		}
+
+		chunk->start = begin;
+		chunk->next = worker->chunks;
+		worker->chunks = chunk;
+
+		search_out_init(chunk->out, chunk->stream);
+		((struct search_result *) worker->arg)->out = chunk->out;
+	}
+
+	for (size_t i = begin; i < end; i++) {
+		int found = (*shared->visit)(shared->nodes[i], worker->arg);
+
+		if (found < 0) {
+			return -1;
+		}
+		worker->count += (found > 0);
+	}
+
+	if (chunk != NULL) {
+		chunk->end = end;
+	}
+	return 0;
+}
+
+/* flush CHUNK's output into its TEXT */
+static int close_chunk (struct walk_chunk *chunk)
+{
+	if (chunk->stream == NULL) {
+		return 0;
+	}
+
+	search_out_flush(chunk->out);
+	int status = fclose(chunk->stream);
+
+	chunk->stream = NULL;
+	free(chunk->out);
+	chunk->out = NULL;
+	return (status == 0) ? 0 : -1;
+}
+
+static int chunk_cmp (const void *a, const void *b)
+{
+	const struct walk_chunk *x = *(struct walk_chunk *const *) a;
+	const struct walk_chunk *y = *(struct walk_chunk *const *) b;
+
+	return (x->start > y->start) - (x->start < y->start);
+}
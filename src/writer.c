@@ -0,0 +1,280 @@
+/* writer.c - buffered, vectored FASTA output */
+
+/* for O_DIRECT */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <bgzf.h>
+#include <genetree.h>
+#include <packseq.h>
+#include <writer.h>
+
+static int writer_bytes (struct record_writer *writer, const char *data, size_t len);
+static int writer_sequence (struct record_writer *writer, const struct gene_node *node,
+			    size_t from, size_t count);
+static int writer_queue (struct record_writer *writer, const void *data, size_t len);
+static void queue_buffer (struct record_writer *writer);
+static int writer_flush (struct record_writer *writer, int final);
+static int write_all (int fd, struct iovec *iov, int niov);
+
+int writer_init (struct record_writer *writer, int fd, size_t wrap, int direct,
+		 size_t bgzf_threads)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, WRITER_ALIGN, WRITER_BUF_SIZE) != 0) {
+		return -1;
+	}
+
+	writer->zbuf = NULL;
+	if (bgzf_threads > 0 && (writer->zbuf = malloc(bgzf_bound(WRITER_BUF_SIZE))) == NULL) {
+		free(buf);
+		return -1;
+	}
+
+	writer->fd = fd;
+	writer->wrap = wrap;
+	writer->direct = direct;
+	writer->bgzf_threads = bgzf_threads;
+	writer->error = 0;
+	writer->buf = buf;
+	writer->len = 0;
+	writer->queued = 0;
+	writer->niov = 0;
+	return 0;
+}
+
+int writer_record (struct record_writer *writer, const struct gene_node *node)
+{
+	if (writer_bytes(writer, ">", 1) == -1 ||
+	    writer_bytes(writer, node->defline, node->defline_len) == -1 ||
+	    writer_bytes(writer, "\n", 1) == -1) {
+		return -1;
+	}
+
+	size_t len = node->sequence_len;
+	size_t line = (writer->wrap == 0) ? len : writer->wrap;
+
+	/* an empty sequence is still written as an empty line */
+	if (len == 0) {
+		return writer_bytes(writer, "\n", 1);
+	}
+
+	for (size_t from = 0; from < len; from += line) {
+		size_t count = (len - from < line) ? len - from : line;
+
+		if (writer_sequence(writer, node, from, count) == -1 ||
+		    writer_bytes(writer, "\n", 1) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int writer_finish (struct record_writer *writer)
+{
+	int status = 0;
+
+	if (writer->direct && writer->len % WRITER_ALIGN != 0) {
+		/* O_DIRECT can't write the last, partial block */
+		int flags = fcntl(writer->fd, F_GETFL);
+
+		if (flags == -1 || fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+			writer->error = errno;
+		}
+	}
+
+	if (writer->error == 0 && writer_flush(writer, 1) == 0 && writer->bgzf_threads > 0) {
+		struct iovec eof = { (void *) bgzf_eof, BGZF_EOF_LEN };
+
+		if (write_all(writer->fd, &eof, 1) == -1) {
+			writer->error = errno;
+		}
+	}
+	if (writer->error != 0) {
+		errno = writer->error;
+		status = -1;
+	}
+
+	free(writer->buf);
+	free(writer->zbuf);
+	writer->buf = NULL;
+	writer->zbuf = NULL;
+	return status;
+}
+
+/*
+ * STATIC FUNCTION DEFINITIONS
+ */
+
+/* copy LEN bytes at DATA into the buffer */
+static int writer_bytes (struct record_writer *writer, const char *data, size_t len)
+{
+	while (len > 0) {
+		if (writer->len == WRITER_BUF_SIZE && writer_flush(writer, 0) == -1) {
+			return -1;
+		}
+
+		size_t n = WRITER_BUF_SIZE - writer->len;
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(writer->buf + writer->len, data, n);
+		writer->len += n;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* write COUNT bases of NODE's sequence, starting at FROM */
+static int writer_sequence (struct record_writer *writer, const struct gene_node *node,
+			    size_t from, size_t count)
+{
+	if (node->lazy != NULL) {
+		/* read in pieces, so the thread's sequence buffer stays small */
+		while (count > 0) {
+			size_t n = (count < WRITER_BUF_SIZE) ? count : WRITER_BUF_SIZE;
+			const char *text = gene_node_window(node, from, n);
+
+			if (text == NULL) {
+				writer->error = EIO;
+				return -1;
+			}
+			if (writer_bytes(writer, text, n) == -1) {
+				return -1;
+			}
+			from += n;
+			count -= n;
+		}
+		return 0;
+	}
+	else if (node->packed == NULL) {
+		/* only bytes in BUF can be written directly or compressed */
+		if (count >= WRITER_ZERO_COPY_MIN && !writer->direct && writer->bgzf_threads == 0) {
+			return writer_queue(writer, node->sequence + from, count);
+		}
+		return writer_bytes(writer, node->sequence + from, count);
+	}
+
+	while (count > 0) {
+		if (writer->len == WRITER_BUF_SIZE && writer_flush(writer, 0) == -1) {
+			return -1;
+		}
+
+		size_t n = WRITER_BUF_SIZE - writer->len;
+		if (n > count) {
+			n = count;
+		}
+
+		unpack_sequence(node->packed, from, n, writer->buf + writer->len);
+		writer->len += n;
+		from += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/* queue LEN bytes at DATA to be written in place, after what is buffered */
+static int writer_queue (struct record_writer *writer, const void *data, size_t len)
+{
+	/* room for the buffered bytes before DATA, and DATA itself */
+	if (writer->niov + 2 > WRITER_IOV && writer_flush(writer, 0) == -1) {
+		return -1;
+	}
+
+	queue_buffer(writer);
+	writer->iov[writer->niov].iov_base = (void *) data;
+	writer->iov[writer->niov].iov_len = len;
+	++(writer->niov);
+	return 0;
+}
+
+/* queue the bytes buffered since the last iovec */
+static void queue_buffer (struct record_writer *writer)
+{
+	if (writer->len > writer->queued) {
+		writer->iov[writer->niov].iov_base = writer->buf + writer->queued;
+		writer->iov[writer->niov].iov_len = writer->len - writer->queued;
+		++(writer->niov);
+		writer->queued = writer->len;
+	}
+}
+
+/* write everything queued or buffered, and empty the buffer, unless part
+   of a BGZF block is held back because this is not the FINAL flush */
+static int writer_flush (struct record_writer *writer, int final)
+{
+	if (writer->error != 0) {
+		return -1;
+	}
+
+	size_t kept = 0;
+
+	if (writer->bgzf_threads > 0 && writer->len > 0) {
+		/* no iovecs point outside BUF, so it is all there is. Until the
+		   end, leave a partial block to be filled by the next flush. */
+		size_t len = writer->len;
+
+		if (!final) {
+			kept = len % BGZF_BLOCK_DATA;
+			len -= kept;
+		}
+
+		writer->iov[0].iov_base = writer->zbuf;
+		writer->iov[0].iov_len = bgzf_compress(writer->buf, len, writer->zbuf, writer->bgzf_threads);
+		writer->niov = 1;
+
+		if (writer->iov[0].iov_len == 0) {
+			writer->error = ENOMEM;
+		}
+	}
+	else {
+		queue_buffer(writer);
+	}
+
+	if (writer->error == 0 && write_all(writer->fd, writer->iov, writer->niov) == -1) {
+		writer->error = errno;
+	}
+
+	memmove(writer->buf, writer->buf + writer->len - kept, kept);
+	writer->len = kept;
+	writer->queued = 0;
+	writer->niov = 0;
+	return (writer->error == 0) ? 0 : -1;
+}
+
+/* writev() all of IOV, however many calls it takes */
+static int write_all (int fd, struct iovec *iov, int niov)
+{
+	while (niov > 0) {
+		ssize_t written = writev(fd, iov, niov);
+
+		if (written == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		/* skip what was written, which may end partway into an iovec */
+		while (niov > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			++iov;
+			--niov;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}